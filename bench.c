@@ -0,0 +1,437 @@
+#ifndef USER_SPACE
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/cpu.h>
+#include <linux/sort.h>
+#else    /// USER_SPACE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#endif   ///USER_SPACE
+
+#include "bigmem.h"
+
+/// 输出格式: 每个用例一行,CSV或JSON Lines
+///   build,op,size,offset,block_size,blocks,threads,iters,batch,mb_s,p50_ns,p99_ns,max_ns
+/// offset为aligned(起始于内存块边界)或straddle(跨越内存块边界)
+/// 每次计时连续调用batch次,p50_ns/p99_ns/max_ns为每批中单次调用的平均耗时,
+/// 小操作的耗时因此不会被计时本身的开销淹没
+
+#define BENCH_MEM_SIZE (80*1024*1024)   ///< 容纳64MB操作及跨块偏移
+#define BENCH_BYTES (256*1024*1024)     ///< 每个线程每个用例的目标数据量
+#define BENCH_BUF_LIMIT (512*1024*1024)  ///< 所有线程缓冲区的总大小上限
+#define BENCH_MIN_ITERS 8
+#define BENCH_MAX_ITERS 20000
+#define BENCH_BATCH_BYTES 4096          ///< 小于该长度的操作每次计时调用多次,每批共操作该字节数
+#define BENCH_MAX_CALLS (1024*1024)     ///< 每个线程每个用例的最大调用次数
+#define BENCH_DATA 0x5a                 ///< 内存和缓冲区的内容,对比时总是全部比较
+
+#define BENCH_READ 0
+#define BENCH_WRITE 1
+#define BENCH_SET 2
+#define BENCH_CMP 3
+#define BENCH_OP_COUNT 4
+
+static const char *bench_op_names[BENCH_OP_COUNT]={"read","write","set","cmp"};
+static const size_t bench_sizes[]={1,64,4096,65536,1024*1024,16*1024*1024,64*1024*1024};
+
+#ifndef USER_SPACE
+#define BENCH_BUILD "kernel"
+#define bench_alloc(size) vmalloc(size)
+#define bench_free(ptr) vfree(ptr)
+#define bench_print(...) printk(KERN_INFO "bigmem_bench: " __VA_ARGS__)
+/// 内核中block_order为0时使用默认值,不测试单块。order为4时大操作涉及上千个内存块,
+/// 超过8个锁分段时独占整个实例加锁,多线程时互相等待
+static const unsigned int bench_orders[]={4,10};
+#else    /// USER_SPACE
+#define BENCH_BUILD "user"
+#define bench_alloc(size) malloc(size)
+#define bench_free(ptr) free(ptr)
+#define bench_print(...) printf(__VA_ARGS__)
+/// 0表示整个bigmem为一个内存块
+static const unsigned int bench_orders[]={0,4,10};
+#endif   /// USER_SPACE
+
+#define ARRAY_LEN(a) (sizeof(a)/sizeof((a)[0]))
+
+/// @brief 一个用例的参数,所有线程共享
+struct bench_case
+{
+	struct big_mem *mem;
+	int op;
+	size_t size;
+	int straddle;   ///< 非0时跨越内存块边界
+	int iters;      ///< 计时次数
+	int batch;      ///< 每次计时的调用次数
+	int threads;
+#ifndef USER_SPACE
+	struct completion start;   ///< 所有线程同时开始
+	atomic_t running;
+	struct completion done;
+#else    /// USER_SPACE
+	pthread_barrier_t start;
+#endif   /// USER_SPACE
+};
+
+/// @brief 每个线程的状态
+struct bench_thread
+{
+	struct bench_case *bcase;
+	size_t begin;    ///< 操作位置
+	char *buf;
+	__u64 *lat;      ///< 每批中单次操作的平均耗时(ns)
+	__u64 start_ns;
+	__u64 end_ns;
+	int err;
+#ifdef USER_SPACE
+	pthread_t tid;
+#endif
+};
+
+static inline __u64 bench_now(void)
+{
+#ifndef USER_SPACE
+	return ktime_get_ns();
+#else    /// USER_SPACE
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (__u64)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+#endif   /// USER_SPACE
+}
+
+static int bench_cmp_u64(const void *a,const void *b)
+{
+	__u64 x=*(const __u64*)a;
+	__u64 y=*(const __u64*)b;
+	return x<y?-1:(x>y?1:0);
+}
+
+static inline void bench_sort(__u64 *lat,size_t count)
+{
+#ifndef USER_SPACE
+	sort(lat,count,sizeof(__u64),bench_cmp_u64,NULL);
+#else    /// USER_SPACE
+	qsort(lat,count,sizeof(__u64),bench_cmp_u64);
+#endif   /// USER_SPACE
+}
+
+static int bench_op(struct big_mem *mem,int op,size_t begin,char *buf,size_t size)
+{
+	int res=0;
+	switch(op)
+	{
+	case BENCH_READ:
+		return read_bigmem(mem,begin,buf,size);
+	case BENCH_WRITE:
+		return write_bigmem(mem,begin,buf,size);
+	case BENCH_SET:
+		return set_bigmem(mem,begin,size,BENCH_DATA);
+	default:
+		return cmp_bigmem(mem,begin,buf,size,&res);
+	}
+}
+
+/// @brief 线程主体,记录每批操作的平均耗时
+static int bench_thread_run(void *data)
+{
+	struct bench_thread *thread=(struct bench_thread*)data;
+	struct bench_case *bcase=thread->bcase;
+	int i=0;
+	int j=0;
+#ifndef USER_SPACE
+	wait_for_completion(&bcase->start);
+#else    /// USER_SPACE
+	pthread_barrier_wait(&bcase->start);
+#endif   /// USER_SPACE
+	thread->start_ns=bench_now();
+	for(i=0;i<bcase->iters&&0==thread->err;i++)
+	{
+		__u64 begin=bench_now();
+		for(j=0;j<bcase->batch&&0==thread->err;j++)
+			thread->err=bench_op(bcase->mem,bcase->op,thread->begin,thread->buf,bcase->size);
+		thread->lat[i]=(bench_now()-begin)/bcase->batch;
+	}
+	thread->end_ns=bench_now();
+#ifndef USER_SPACE
+	if(atomic_dec_and_test(&bcase->running))
+		complete(&bcase->done);
+#endif
+	return 0;
+}
+
+#ifndef USER_SPACE
+/// @brief 第t个线程绑定的CPU,按序使用在线的CPU,CPU编号可能不连续
+static unsigned int bench_cpu(int t)
+{
+	unsigned int n=t%num_online_cpus();
+	unsigned int cpu=0;
+	for_each_online_cpu(cpu)
+		if(0==n--)
+			break;
+	return cpu;
+}
+#else    /// USER_SPACE
+static void *bench_pthread_run(void *data)
+{
+	bench_thread_run(data);
+	return NULL;
+}
+#endif
+
+/// @brief 计算线程t的操作位置,各线程尽量位于不同的内存块
+static size_t bench_begin(struct big_mem *mem,size_t size,int straddle,int t)
+{
+	size_t block=mem->sizes[0];
+	size_t region=(size_t)t*((size+block-1)/block+1)*block;
+	size_t half=size>1?size/2:1;
+	if(region+2*block+size>mem->mem_size)
+		region=0;
+	if(!straddle)
+		return region;
+	/// 操作的中点位于一个内存块边界上
+	return region+(half/block+1)*block-half;
+}
+
+/// @brief 运行一个用例并输出一行结果
+/// @retval 0成功 <0失败
+static int bench_case_run(struct bench_case *bcase,int json)
+{
+	struct bench_thread *threads=NULL;
+	__u64 *lat=NULL;
+	size_t samples=(size_t)bcase->iters*bcase->threads;
+	__u64 first=0;
+	__u64 last=0;
+	__u64 wall_ns=0;
+	__u64 mb_s=0;   ///< 千分之一MB/s
+	int t=0;
+	int err=0;
+	threads=(struct bench_thread*)bench_alloc(sizeof(struct bench_thread)*bcase->threads);
+	lat=(__u64*)bench_alloc(sizeof(__u64)*samples);
+	if(NULL==threads||NULL==lat)
+	{
+		err=-ENOMEM;
+		goto free_mem;
+	}
+	memset(threads,0,sizeof(struct bench_thread)*bcase->threads);
+	for(t=0;t<bcase->threads;t++)
+	{
+		threads[t].bcase=bcase;
+		threads[t].begin=bench_begin(bcase->mem,bcase->size,bcase->straddle,t);
+		threads[t].lat=lat+(size_t)t*bcase->iters;
+		if(NULL==(threads[t].buf=(char*)bench_alloc(bcase->size)))
+		{
+			err=-ENOMEM;
+			goto free_buf;
+		}
+		memset(threads[t].buf,BENCH_DATA,bcase->size);
+	}
+#ifndef USER_SPACE
+	init_completion(&bcase->start);
+	init_completion(&bcase->done);
+	atomic_set(&bcase->running,bcase->threads);
+	/// 绑定期间CPU不会下线
+	cpus_read_lock();
+	for(t=0;t<bcase->threads;t++)
+	{
+		struct task_struct *task=kthread_create(bench_thread_run,&threads[t],"bigmem_bench/%d",t);
+		if(IS_ERR(task))
+		{
+			threads[t].err=PTR_ERR(task);
+			if(atomic_dec_and_test(&bcase->running))
+				complete(&bcase->done);
+			continue;
+		}
+		kthread_bind(task,bench_cpu(t));
+		wake_up_process(task);
+	}
+	cpus_read_unlock();
+	complete_all(&bcase->start);
+	wait_for_completion(&bcase->done);
+#else    /// USER_SPACE
+	pthread_barrier_init(&bcase->start,NULL,bcase->threads);
+	for(t=0;t<bcase->threads;t++)
+		if(pthread_create(&threads[t].tid,NULL,bench_pthread_run,&threads[t])!=0)
+		{
+			/// 已创建的线程在屏障处等待,无法继续
+			fprintf(stderr,"pthread_create failed\n");
+			exit(1);
+		}
+	for(t=0;t<bcase->threads;t++)
+		pthread_join(threads[t].tid,NULL);
+	pthread_barrier_destroy(&bcase->start);
+#endif   /// USER_SPACE
+	for(t=0;t<bcase->threads;t++)
+	{
+		if(threads[t].err<0)
+		{
+			err=threads[t].err;
+			goto free_buf;
+		}
+		if(0==t||threads[t].start_ns<first)
+			first=threads[t].start_ns;
+		if(threads[t].end_ns>last)
+			last=threads[t].end_ns;
+	}
+	wall_ns=last-first;
+	if(wall_ns>0)
+		mb_s=(__u64)bcase->size*samples*bcase->batch*1000000/wall_ns;
+	bench_sort(lat,samples);
+	if(json)
+		bench_print("{\"build\":\"%s\",\"op\":\"%s\",\"size\":%zu,\"offset\":\"%s\",\"block_size\":%zu,\"blocks\":%lu,"
+				"\"threads\":%d,\"iters\":%d,\"batch\":%d,\"mb_s\":%llu.%03llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}\n",
+				BENCH_BUILD,bench_op_names[bcase->op],bcase->size,bcase->straddle?"straddle":"aligned",
+				bcase->mem->sizes[0],bcase->mem->mem_count,bcase->threads,bcase->iters,bcase->batch,
+				(unsigned long long)mb_s/1000,(unsigned long long)mb_s%1000,(unsigned long long)lat[samples/2],
+				(unsigned long long)lat[samples*99/100],(unsigned long long)lat[samples-1]);
+	else
+		bench_print("%s,%s,%zu,%s,%zu,%lu,%d,%d,%d,%llu.%03llu,%llu,%llu,%llu\n",
+				BENCH_BUILD,bench_op_names[bcase->op],bcase->size,bcase->straddle?"straddle":"aligned",
+				bcase->mem->sizes[0],bcase->mem->mem_count,bcase->threads,bcase->iters,bcase->batch,
+				(unsigned long long)mb_s/1000,(unsigned long long)mb_s%1000,(unsigned long long)lat[samples/2],
+				(unsigned long long)lat[samples*99/100],(unsigned long long)lat[samples-1]);
+free_buf:
+	for(t=0;t<bcase->threads;t++)
+		if(threads[t].buf!=NULL)
+			bench_free(threads[t].buf);
+free_mem:
+	if(threads!=NULL)
+		bench_free(threads);
+	if(lat!=NULL)
+		bench_free(lat);
+	return err;
+}
+
+/// @brief 对每种内存块大小、操作、长度、偏移和线程数运行用例
+/// @param[in] max_threads 最大线程数,从1开始每次翻倍
+/// @param[in] max_size 最大操作长度
+static int bench_all(int max_threads,size_t max_size,int json)
+{
+	struct bench_case bcase;
+	struct big_mem mem;
+	unsigned int o=0;
+	int err=0;
+	if(!json)
+		bench_print("build,op,size,offset,block_size,blocks,threads,iters,batch,mb_s,p50_ns,p99_ns,max_ns\n");
+	for(o=0;o<ARRAY_LEN(bench_orders)&&0==err;o++)
+	{
+		struct bigmem_attr attr={.block_order=bench_orders[o]};
+		unsigned int s=0;
+#ifndef USER_SPACE
+		err=init_bigmem_attr(&mem,BENCH_MEM_SIZE,GFP_KERNEL,&attr);
+#else    /// USER_SPACE
+		err=init_bigmem_attr(&mem,BENCH_MEM_SIZE,BIGMEM_POPULATE,&attr);
+#endif   /// USER_SPACE
+		if(err<0)
+			break;
+		if((err=set_bigmem(&mem,0,BENCH_MEM_SIZE,BENCH_DATA))<0)
+			goto clean;
+		for(s=0;s<ARRAY_LEN(bench_sizes)&&bench_sizes[s]<=max_size&&0==err;s++)
+		{
+			size_t batch=bench_sizes[s]<BENCH_BATCH_BYTES?BENCH_BATCH_BYTES/bench_sizes[s]:1;
+			size_t iters=BENCH_BYTES/(bench_sizes[s]*batch);
+			if(iters>BENCH_MAX_CALLS/batch)
+				iters=BENCH_MAX_CALLS/batch;
+			if(iters<BENCH_MIN_ITERS)
+				iters=BENCH_MIN_ITERS;
+			if(iters>BENCH_MAX_ITERS)
+				iters=BENCH_MAX_ITERS;
+			bcase.mem=&mem;
+			bcase.size=bench_sizes[s];
+			bcase.iters=(int)iters;
+			bcase.batch=(int)batch;
+			for(bcase.op=0;bcase.op<BENCH_OP_COUNT&&0==err;bcase.op++)
+				/// 单块时没有内存块边界
+				for(bcase.straddle=0;bcase.straddle<(mem.mem_count>1?2:1)&&0==err;bcase.straddle++)
+					for(bcase.threads=1;bcase.threads<=max_threads&&(size_t)bcase.threads*bcase.size<=BENCH_BUF_LIMIT&&0==err;bcase.threads*=2)
+						err=bench_case_run(&bcase,json);
+		}
+clean:
+		clean_bigmem(&mem);
+	}
+	return err;
+}
+
+#ifndef USER_SPACE
+static int max_threads=0;
+module_param(max_threads,int,0444);
+MODULE_PARM_DESC(max_threads,"maximum number of threads, 0 for all online CPUs");
+static unsigned long max_size=64*1024*1024;
+module_param(max_size,ulong,0444);
+MODULE_PARM_DESC(max_size,"maximum operation size in bytes");
+static int json=0;
+module_param(json,int,0444);
+MODULE_PARM_DESC(json,"print JSON lines instead of CSV");
+
+static int __init bench_init(void)
+{
+	int err=bench_all(max_threads>0?max_threads:num_online_cpus(),max_size,json);
+	if(err<0)
+		printk(KERN_ERR "bigmem_bench: failed %d\n",err);
+	return 0;
+}
+
+static void __exit bench_exit(void)
+{
+}
+
+module_init(bench_init);
+module_exit(bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("benchmark for bigmem");
+MODULE_AUTHOR("hzy(hzy.oop@gmail.com");
+#else    /// USER_SPACE
+
+static void usage(const char *name)
+{
+	fprintf(stderr,"usage: %s [-t max_threads] [-s max_size] [-j]\n",name);
+	fprintf(stderr,"  -t  maximum number of threads, default all online CPUs\n");
+	fprintf(stderr,"  -s  maximum operation size in bytes, default 64MB\n");
+	fprintf(stderr,"  -j  print JSON lines instead of CSV\n");
+}
+
+int main(int argc,char *argv[])
+{
+	int max_threads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max_size=64*1024*1024;
+	int json=0;
+	int opt=0;
+	int err=0;
+	while((opt=getopt(argc,argv,"t:s:j"))!=-1)
+	{
+		switch(opt)
+		{
+		case 't':
+			max_threads=atoi(optarg);
+			break;
+		case 's':
+			max_size=strtoull(optarg,NULL,0);
+			break;
+		case 'j':
+			json=1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(max_threads<1)
+		max_threads=1;
+	if((err=bench_all(max_threads,max_size,json))<0)
+	{
+		fprintf(stderr,"bench failed: %s\n",strerror(-err));
+		return 1;
+	}
+	return 0;
+}
+
+#endif   ///USER_SPACE
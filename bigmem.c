@@ -3,490 +3,3567 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/log2.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/nodemask.h>
+#include <linux/bitops.h>
+#include <linux/crc32c.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kref.h>
+#include <linux/srcu.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
 #else    /// USER_SPACE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   ///< O_DIRECT
+#endif
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 #endif   ///USER_SPACE
 
 #include "bigmem.h"
 
+#ifndef USER_SPACE
+#define CREATE_TRACE_POINTS
+#include "bigmem_trace.h"
+#endif   /// USER_SPACE
+
 #define AUTHOR "hzy(hzy.oop@gmail.com)"
 #define DESCRIPTION "a big mem data structure"
 #define VERSION "1.0"
 
 
+#ifndef USER_SPACE
+#define bigmem_malloc(size) kvmalloc(size,GFP_KERNEL)
+#define bigmem_free(ptr) kvfree(ptr)
+#else    /// USER_SPACE
+#define bigmem_malloc(size) malloc(size)
+#define bigmem_free(ptr) free(ptr)
+#endif   /// USER_SPACE
+
 /// @brief 依据内存index计算，内存单元所在的块号和，块内索引
+/// @note 前部等大的内存块通过移位直接定位,其余内存块在offsets上二分查找
 /// @retval 0成功 <0失败
-static int cal_bigmem_coord(struct big_mem *mem,size_t index,unsigned long *block_index,size_t *inner_index)
+static inline int cal_bigmem_coord(struct big_mem *mem,size_t index,unsigned long *block_index,size_t *inner_index)
 {
-	int i=0;
-	size_t sum=0;
+	unsigned long i=0;
 	if(mem==NULL)
 		return -EINVAL;
 	if(index>=mem->mem_size)
 		return -EFAULT;
 	/// 计算块号
-	for(i=0;i<mem->mem_count;i++)
+	i=index>>mem->block_shift;
+	if(i>=mem->uniform_count)
 	{
-		size_t end;
-		end=sum+mem->sizes[i];
-		if(sum<=index&&end>index)
-			break;
-		sum=end;
+		unsigned long low=mem->uniform_count;
+		unsigned long high=mem->mem_count;
+		/// 查找满足offsets[i]<=index的最大i
+		while(high-low>1)
+		{
+			unsigned long mid=low+(high-low)/2;
+			if(mem->offsets[mid]<=index)
+				low=mid;
+			else
+				high=mid;
+		}
+		i=low;
 	}
-	/// 判断是否越界
-	if(i==mem->mem_count)
-		return -ENOMEM;
 	if(NULL!=block_index)
 		*block_index=i;
 	if(inner_index!=NULL)
-		*inner_index=index-sum;
+		*inner_index=index-mem->offsets[i];
+	return 0;
+}
+
+/// @brief 依据sizes建立块索引(offsets,block_shift,uniform_count)
+/// @retval 0成功 <0失败
+static int index_bigmem(struct big_mem *mem)
+{
+	unsigned long i=0;
+	size_t size=0;
+	if(NULL==mem||NULL==mem->sizes||0==mem->mem_count)
+		return -EINVAL;
+	mem->offsets=(size_t*)bigmem_malloc(sizeof(size_t)*(mem->mem_count+1));
+	if(NULL==mem->offsets)
+		return -ENOMEM;
+	/// 计算前缀和
+	mem->offsets[0]=0;
+	for(i=0;i<mem->mem_count;i++)
+	{
+		/// 空内存块会使坐标计算落在其中,块内剩余长度下溢
+		if(0==mem->sizes[i])
+		{
+			bigmem_free(mem->offsets);
+			mem->offsets=NULL;
+			return -EINVAL;
+		}
+		mem->offsets[i+1]=mem->offsets[i]+mem->sizes[i];
+	}
+	if(mem->offsets[mem->mem_count]!=mem->mem_size)
+	{
+		bigmem_free(mem->offsets);
+		mem->offsets=NULL;
+		return -EINVAL;
+	}
+	/// 首块大小为2的幂时,统计前部等大内存块
+	size=mem->sizes[0];
+	mem->block_shift=0;
+	mem->uniform_count=0;
+	if(0==(size&(size-1)))
+	{
+		while(((size_t)1<<mem->block_shift)<size)
+			mem->block_shift++;
+		while(mem->uniform_count<mem->mem_count&&mem->sizes[mem->uniform_count]==size)
+			mem->uniform_count++;
+	}
 	return 0;
 }
 
 #ifndef USER_SPACE
-/// @brief 依据大小计算内存块数,及末尾块大小
+/// 伙伴系统单次分配的最大order值。6.8起为MAX_PAGE_ORDER;6.4到6.7的MAX_ORDER
+/// 已是包含的上限;更早的MAX_ORDER为不包含的上限
+#ifdef MAX_PAGE_ORDER
+#define BIGMEM_PAGE_ORDER_LIMIT MAX_PAGE_ORDER
+#elif LINUX_VERSION_CODE>=KERNEL_VERSION(6,4,0)
+#define BIGMEM_PAGE_ORDER_LIMIT MAX_ORDER
+#else
+#define BIGMEM_PAGE_ORDER_LIMIT (MAX_ORDER-1)
+#endif
+
+/// @brief 依据大小计算内存块数
+/// @note 不足整块的末尾部分拆分为若干个2的幂页大小的内存块,由大到小排列
+/// @param[in] order 整块的order值
 /// @param[out] count内存块个数
-/// @param[out] size 未块的大小
 /// @retval 0成功, -1失败
-static int mem_count(size_t mem_size,unsigned long *mem_count,size_t *block_size)
+static int mem_count(size_t mem_size,unsigned int order,unsigned long *mem_count)
 {
-	int order=0;
-	int count=0;   ///< 内存块数
-	size_t size=0;   ///< 内存末块的大小
+	unsigned long count=0;   ///< 内存块数
+	size_t full_size=PAGE_SIZE<<order;   ///< 整块大小
 	/// mem_size非法参数
 	if(mem_size==0)
 		return -EINVAL;
-	/// 计算count,size
-	order=get_order(mem_size);
-
-	count=order-BIGMEM_MAX_ORDER>0?1<<(order-BIGMEM_MAX_ORDER):1;
-	size=count==1?mem_size:mem_size-(1<<BIGMEM_MAX_ORDER)*PAGE_SIZE;
-	if(count>BIGMEM_MAX_COUNT)
-		return -ENOMEM;
+	/// 计算整块及末尾内存块的数量
+	count=mem_size/full_size;
+	count+=hweight_long(PAGE_ALIGN(mem_size%full_size)>>PAGE_SHIFT);
 	///返回
 	if(NULL!=mem_count)
 		*mem_count=count;
-	if(NULL!=block_size)
-		*block_size=size;
 	return 0;
 }
+
+/// @brief 计算剩余left字节时,下一个内存块的大小
+/// @param[in] order 整块的order值
+static size_t next_block_size(size_t left,unsigned int order)
+{
+	unsigned long pages=PAGE_ALIGN(left)>>PAGE_SHIFT;
+	size_t size=PAGE_SIZE<<order;
+	/// 末尾部分取不超过剩余页数的最大2的幂
+	if(pages<(1UL<<order))
+		size=PAGE_SIZE<<ilog2(pages);
+	return size<left?size:left;
+}
 #endif  /// USER_SPACE
 
-static int _write_bigmem(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size)
+/// @brief 检查[begin,begin+len)是否位于mem的范围内
+/// @retval 0成功 <0失败
+static inline int check_bigmem_range(struct big_mem *mem,size_t begin,size_t len)
 {
-	unsigned long block_index0,block_index1;  ///< 起止内存块索引
-	size_t inner_index0,inner_index1;    ///< 起止内存内索引
-	size_t end=begin+buf_size-1;
-	int err=0;
 	if(NULL==mem)
 		return -EINVAL;
-	if((err=cal_bigmem_coord(mem,begin,&block_index0,&inner_index0))<0)
-		return err;
-	if((err=cal_bigmem_coord(mem,end,&block_index1,&inner_index1))<0)
-		return err;
-	/// 禁止跨越两个内存块
-	if(block_index1-block_index0>1)
+	if(begin>=mem->mem_size||len>mem->mem_size-begin)
 		return -EFAULT;
-	/// 内存拷贝
-	if(block_index1==block_index0)
-		memcpy((void*)(mem->addrs[block_index0]+inner_index0),buf,buf_size);
-	else
-	{
-		size_t len=mem->sizes[block_index0]-inner_index0;
-		memcpy((void*)(mem->addrs[block_index0]+inner_index0),buf,len);
-		memcpy((void*)(mem->addrs[block_index1]),buf+len,buf_size-len);
-	}
 	return 0;
 }
 
-/// @brief 读取数据到缓冲区
-static int _read_bigmem(struct big_mem *mem,size_t begin,void *buf,size_t buf_size)
+#define BIGMEM_LONG_BITS (sizeof(unsigned long)*8)   ///< 位图每个字的位数
+
+/// @brief 清除内存块的CRC32C缓存有效位,未启用缓存时不做任何操作
+static inline void clear_block_crc(struct big_mem *mem,unsigned long block_index)
 {
-	unsigned long block_index0,block_index1;  ///< 起止内存块索引
-	size_t inner_index0,inner_index1;    ///< 起止内存内索引
-	size_t end=begin+buf_size-1;
-	int err=0;
-	if(NULL==mem)
-		return -EINVAL;
-	/// 计算起止地址内存坐标
-	if((err=cal_bigmem_coord(mem,begin,&block_index0,&inner_index0))<0)
-		return err;
-	if((err=cal_bigmem_coord(mem,end,&block_index1,&inner_index1))<0)
-		return err;
-	/// 禁止间隔两个内存块的读取
-	if(block_index1-block_index0>1)
-		return -EFAULT;
-	/// 复制数据到buf
-	if(block_index0==block_index1)
-		memcpy(buf,(void*)(mem->addrs[block_index0]+inner_index0),buf_size);
-	else
-	{
-		size_t len=mem->sizes[block_index0]-inner_index0;
-		memcpy(buf,(void*)(mem->addrs[block_index0]+inner_index0),len);
-		memcpy(buf+len,(void*)(mem->addrs[block_index1]),buf_size-len);
-	}
-	return err;
+	if(NULL==mem->crc_valid)
+		return;
+#ifndef USER_SPACE
+	clear_bit(block_index,mem->crc_valid);
+#else    /// USER_SPACE
+	__atomic_fetch_and(&mem->crc_valid[block_index/BIGMEM_LONG_BITS],~(1UL<<(block_index%BIGMEM_LONG_BITS)),__ATOMIC_RELAXED);
+#endif   /// USER_SPACE
 }
 
-/// @brief 设置内存数据为data
-static int _set_bigmem(struct big_mem *mem,size_t begin,size_t len,char data)
+#define STREAM_FILL_SIZE 256   ///< 内核流式设置时每次复制的模板大小
+
+#if !defined(USER_SPACE)&&defined(BIGMEM_STATS)
+/// @brief 记录一次操作,未启用统计时只有一次判断
+static inline void stat_bigmem_op(struct big_mem *mem,int type,size_t len,int cross)
 {
-	unsigned long block_index0,block_index1;  ///< 起止内存块索引
-	size_t inner_index0,inner_index1;    ///< 起止内存内索引
-	size_t end=begin+len-1;
-	int err=0;
-	int i=0;
+	struct bigmem_stats __percpu *stats=mem->stats;
+	if(NULL==stats)
+		return;
+	this_cpu_inc(stats->ops[type]);
+	this_cpu_add(stats->bytes[type],len);
+	if(cross)
+		this_cpu_inc(stats->cross_block);
+}
 
-	if(NULL==mem)
-		return -EINVAL;
-	if((err=cal_bigmem_coord(mem,begin,&block_index0,&inner_index0))<0)
-		return err;
-	if((err=cal_bigmem_coord(mem,end,&block_index1,&inner_index1))<0)
-		return err;
-	/// 设置内存值
-	if(block_index0==block_index1)
-	{
-		memset((void*)(mem->addrs[block_index0]+inner_index0),data,inner_index1-inner_index0+1);
-		return 0;
-	}
-	for(i=block_index0;i<=block_index1;i++)
-	{
-		size_t len=0;
-		if(i==block_index0)
-			len=mem->sizes[block_index0]-inner_index0;
-		else if(i==block_index1)
-			len=inner_index1+1;
-		else
-			len=mem->sizes[i];
+/// @brief 记录一次失败的操作
+static inline void stat_bigmem_error(struct big_mem *mem)
+{
+	if(NULL!=mem&&NULL!=mem->stats)
+		this_cpu_inc(mem->stats->errors);
+}
 
-		if(i==block_index0)
-			memset((void*)(mem->addrs[i]+inner_index0),data,len);
-		else
-			memset((void*)(mem->addrs[i]),data,len);
-	}
-	return 0;
+/// @brief 时间所在的直方图桶
+static inline unsigned int stat_bucket(u64 ns)
+{
+	unsigned int bucket=ns>1?ilog2(ns):0;
+	return bucket<BIGMEM_STAT_BUCKETS?bucket:BIGMEM_STAT_BUCKETS-1;
 }
 
-/// @brief 对比内存缓冲区的数据
-/// @param[out] res比较结果
-static int _cmp_bigmem(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res)
+#define stat_bigmem_enabled(mem) (NULL!=(mem)->stats)
+#elif defined(BIGMEM_STATS)   /// USER_SPACE
+#define BIGMEM_STAT_SHARDS 16   ///< 统计分片数,为2的幂
+
+/// @brief 一个统计分片,独占缓存行,线程按所在CPU选择分片
+struct bigmem_stat_shard
 {
-	unsigned long block_index0,block_index1;  ///< 起止内存块索引
-	size_t inner_index0,inner_index1;    ///< 起止内存内索引
-	size_t end=begin+buf_size-1;
-	int err=0;
-	int i=0;
+	struct bigmem_stats stats;
+} __attribute__((aligned(64)));
 
-	if(NULL==mem)
-		return -EINVAL;
-	if(NULL==res)
-		return -EINVAL;
-	if((err=cal_bigmem_coord(mem,begin,&block_index0,&inner_index0))<0)
-		return err;
-	if((err=cal_bigmem_coord(mem,end,&block_index1,&inner_index1))<0)
-		return err;
-	/// 内存对比
-	if(block_index0==block_index1)
-		*res=memcmp(buf,(void*)(mem->addrs[block_index0]+inner_index0),buf_size);
-	else
+/// @brief 当前CPU对应的分片,不同分片的计数互不干扰,同一分片用原子加保证不丢失
+static inline struct bigmem_stats *stat_shard(struct big_mem *mem)
+{
+	int cpu=sched_getcpu();
+	return &mem->stats[(cpu<0?0:cpu)&(BIGMEM_STAT_SHARDS-1)].stats;
+}
+
+/// @brief 记录一次操作,未启用统计时只有一次判断
+static inline void stat_bigmem_op(struct big_mem *mem,int type,size_t len,int cross)
+{
+	struct bigmem_stats *stats=NULL;
+	if(NULL==mem->stats)
+		return;
+	stats=stat_shard(mem);
+	__atomic_fetch_add(&stats->ops[type],1,__ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->bytes[type],len,__ATOMIC_RELAXED);
+	if(cross)
+		__atomic_fetch_add(&stats->cross_block,1,__ATOMIC_RELAXED);
+}
+
+/// @brief 记录一次失败的操作
+static inline void stat_bigmem_error(struct big_mem *mem)
+{
+	if(NULL!=mem&&NULL!=mem->stats)
+		__atomic_fetch_add(&stat_shard(mem)->errors,1,__ATOMIC_RELAXED);
+}
+
+#define stat_bigmem_enabled(mem) (NULL!=(mem)->stats)
+#else    /// !BIGMEM_STATS
+#define stat_bigmem_op(mem,type,len,cross) do{(void)(type);}while(0)
+#define stat_bigmem_error(mem) do{}while(0)
+#define stat_bigmem_enabled(mem) 0
+#endif   /// !BIGMEM_STATS
+
+#ifndef USER_SPACE
+/// @brief 触发访问跟踪点,跟踪点启用时才计算涉及的内存块数
+static inline void trace_bigmem_op(struct big_mem *mem,int op,size_t begin,size_t len,unsigned long block_index)
+{
+	unsigned long last=block_index;
+	size_t inner_index;
+	if(!trace_bigmem_access_enabled())
+		return;
+	cal_bigmem_coord(mem,begin+len-1,&last,&inner_index);
+	trace_bigmem_access(mem,op,begin,len,block_index,last-block_index+1);
+}
+#define trace_bigmem_enabled() trace_bigmem_access_enabled()
+#else    /// USER_SPACE
+#define trace_bigmem_op(mem,op,begin,len,block_index) do{}while(0)
+#define trace_bigmem_enabled() 0
+#endif   /// USER_SPACE
+
+/// @brief 记录一次接口调用的统计和跟踪
+/// @note 由公开接口在操作成功后调用,分批加锁或无锁读重试时也只记录一次
+static inline void account_bigmem_op(struct big_mem *mem,int op,size_t begin,size_t len)
+{
+	unsigned long first=0;
+	unsigned long last=0;
+	if(0==len||!(stat_bigmem_enabled(mem)||trace_bigmem_enabled()))
+		return;
+	cal_bigmem_coord(mem,begin,&first,NULL);
+	cal_bigmem_coord(mem,begin+len-1,&last,NULL);
+	stat_bigmem_op(mem,op,len,last!=first);
+	trace_bigmem_op(mem,op,begin,len,first);
+}
+
+/// @brief 标记[begin,begin+len)所在区间为脏,须在数据写入之后调用
+/// @note 每个字只在有未置位的位时执行一次原子或操作;读取位之前的全屏障与fetch_bigmem_dirty中的交换配对,
+/// 看到位已置位时,消费者的交换一定在数据写入之后,不会漏掉这次写入
+static void mark_dirty(struct big_mem *mem,size_t begin,size_t len)
+{
+	unsigned long first=0;
+	unsigned long last=0;
+	if(NULL==mem->dirty||0==len)
+		return;
+	first=begin>>mem->dirty_shift;
+	last=(begin+len-1)>>mem->dirty_shift;
+#ifndef USER_SPACE
+	/// 数据写入先于读取脏位图
+	smp_mb();
+#else    /// USER_SPACE
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif   /// USER_SPACE
+	while(first<=last)
 	{
-		for(i=block_index0;i<=block_index0;i++)
-		{
-			size_t len;
-			if(i==block_index0)
-				len=mem->sizes[i]-inner_index0;
-			else if(i==block_index1)
-				len=inner_index1+1;
-			else
-				len=mem->sizes[i];
-			
-			if(i==block_index0)
-			{
-				if((*res=memcmp((void*)(mem->addrs[i]+inner_index0),buf,len))!=0)
-					break;
-			}
-			else
-			{
-				if((*res=memcmp((void*)(mem->addrs[i]),buf,len))!=0)
-					break;
-			}
-			buf+=len;
-		}
+		unsigned long word=first/BIGMEM_LONG_BITS;
+		unsigned int bit=first%BIGMEM_LONG_BITS;
+		unsigned long n=BIGMEM_LONG_BITS-bit;
+		unsigned long mask=0;
+		if(n>last-first+1)
+			n=last-first+1;
+		mask=(n==BIGMEM_LONG_BITS?~0UL:(1UL<<n)-1)<<bit;
+#ifndef USER_SPACE
+		if((atomic_long_read(&mem->dirty[word])&mask)!=mask)
+			atomic_long_or(mask,&mem->dirty[word]);
+#else    /// USER_SPACE
+		if((__atomic_load_n(&mem->dirty[word],__ATOMIC_RELAXED)&mask)!=mask)
+			__atomic_fetch_or(&mem->dirty[word],mask,__ATOMIC_RELEASE);
+#endif   /// USER_SPACE
+		first+=n;
 	}
-	return err;
 }
 
-#ifndef USER_SPACE
-/// @brief 初始化bigmem结构
-/// @param[in] size 内存大小
-/// @retval 0成功,<0失败
-int init_bigmem(struct big_mem *mem,size_t mem_size,gfp_t flags)
+/// @brief 使用非临时存储复制数据,不将目标地址读入缓存
+static void stream_copy(void *dst,const void *src,size_t len)
 {
-	int err=0;   ///< 错误码
-	unsigned long block_count;   ///< 内存块
-	size_t end_size;   ///< 末块大小
-	int i;
-	int mem_index=0;
-	
-	/// 判断参数
-	if(NULL==mem)
-		return -EINVAL;
-	if((err=mem_count(mem_size,&block_count,&end_size))<0)
-		return err;
-	if(NULL==mem)
-		return -EINVAL;
-	/// 初始化内存块
-	err=0;
-	mem->mem_size=mem_size;
-	mem->mem_count=block_count;
-	mem->addrs=(unsigned long*)kmalloc(sizeof(unsigned long)*mem->mem_count,GFP_KERNEL|GFP_ATOMIC);
-	mem->sizes=(size_t*)kmalloc(sizeof(size_t)*mem->mem_count,GFP_KERNEL|GFP_ATOMIC);
-	if(NULL==mem->addrs||NULL==mem->sizes)
+#ifndef USER_SPACE
+	memcpy_flushcache(dst,src,len);
+#elif defined(__x86_64__)   /// USER_SPACE
+	char *d=(char*)dst;
+	const char *s=(const char*)src;
+	size_t head=(16-((unsigned long)d&15))&15;
+	if(head>len)
+		head=len;
+	/// 目标按16字节对齐后使用movntdq
+	memcpy(d,s,head);
+	d+=head;
+	s+=head;
+	len-=head;
+	for(;len>=64;d+=64,s+=64,len-=64)
 	{
-		err=-ENOMEM;
-		goto clean_addrs;
+		__m128i x0=_mm_loadu_si128((const __m128i*)s);
+		__m128i x1=_mm_loadu_si128((const __m128i*)(s+16));
+		__m128i x2=_mm_loadu_si128((const __m128i*)(s+32));
+		__m128i x3=_mm_loadu_si128((const __m128i*)(s+48));
+		_mm_stream_si128((__m128i*)d,x0);
+		_mm_stream_si128((__m128i*)(d+16),x1);
+		_mm_stream_si128((__m128i*)(d+32),x2);
+		_mm_stream_si128((__m128i*)(d+48),x3);
 	}
-	/// 分配内存
-	for(mem_index=0;mem_index<mem->mem_count-1;mem_index++)
+	for(;len>=16;d+=16,s+=16,len-=16)
+		_mm_stream_si128((__m128i*)d,_mm_loadu_si128((const __m128i*)s));
+	memcpy(d,s,len);
+#else    /// USER_SPACE
+	memcpy(dst,src,len);
+#endif   /// USER_SPACE
+}
+
+/// @brief 使用非临时存储设置数据
+static void stream_fill(void *dst,char data,size_t len)
+{
+#ifndef USER_SPACE
+	/// 内核没有通用的非临时memset,重复复制一段模板
+	unsigned long pattern[STREAM_FILL_SIZE/sizeof(unsigned long)];
+	char *d=(char*)dst;
+	memset(pattern,data,sizeof(pattern));
+	while(len>0)
 	{
-		if((mem->addrs[mem_index]=__get_free_pages(flags,BIGMEM_MAX_ORDER))==0)
-		{
-			err=-ENOMEM;
-			goto clean_pages;
-		}
-		mem->sizes[mem_index]=(1<<BIGMEM_MAX_ORDER)*PAGE_SIZE;
+		size_t seg=len>sizeof(pattern)?sizeof(pattern):len;
+		memcpy_flushcache(d,pattern,seg);
+		d+=seg;
+		len-=seg;
 	}
-	mem->addrs[mem->mem_count-1]=__get_free_pages(flags,get_order(end_size));
-	mem_index++;
-	mem->sizes[mem->mem_count-1]=end_size;
-	if(mem->addrs[mem->mem_count-1]==0)
+#elif defined(__x86_64__)   /// USER_SPACE
+	char *d=(char*)dst;
+	const __m128i x=_mm_set1_epi8(data);
+	size_t head=(16-((unsigned long)d&15))&15;
+	if(head>len)
+		head=len;
+	memset(d,data,head);
+	d+=head;
+	len-=head;
+	for(;len>=64;d+=64,len-=64)
 	{
-		err=-ENOMEM;
-		goto clean_pages;
+		_mm_stream_si128((__m128i*)d,x);
+		_mm_stream_si128((__m128i*)(d+16),x);
+		_mm_stream_si128((__m128i*)(d+32),x);
+		_mm_stream_si128((__m128i*)(d+48),x);
 	}
-	/// 初始化锁
-	rwlock_init(&mem->lock);
-	return err;
-clean_pages:
-	for(i=0;i<mem_index;i++)
+	for(;len>=16;d+=16,len-=16)
+		_mm_stream_si128((__m128i*)d,x);
+	memset(d,data,len);
+#else    /// USER_SPACE
+	memset(dst,data,len);
+#endif   /// USER_SPACE
+}
+
+/// @brief 非临时存储是弱序的,解锁或发布数据前须等待其完成
+static inline void stream_fence(void)
+{
+#ifndef USER_SPACE
+	wmb();
+#elif defined(__x86_64__)   /// USER_SPACE
+	_mm_sfence();
+#endif   /// USER_SPACE
+}
+
+/// @brief 单次写入/设置len字节时是否使用非临时存储
+static inline int use_stream(const struct big_mem *mem,size_t len)
+{
+#ifndef USER_SPACE
+	size_t threshold=READ_ONCE(mem->stream_threshold);
+#else    /// USER_SPACE
+	size_t threshold=mem->stream_threshold;
+#endif   /// USER_SPACE
+	return threshold!=0&&len>=threshold;
+}
+
+/// @brief 从内存坐标(block_index,inner_index)开始,逐块写入缓冲区数据
+static void copy_to_blocks(struct big_mem *mem,unsigned long block_index,size_t inner_index,const void *buf,size_t len)
+{
+	const int stream=use_stream(mem,len);
+	const size_t begin=mem->offsets[block_index]+inner_index;
+	const size_t total=len;
+	while(len>0)
 	{
-		if(i==mem->mem_count-1)
-		{
-			free_pages(mem->addrs[i],get_order(end_size));
-			mem->addrs[i]=0;
-		}
+		size_t seg=mem->sizes[block_index]-inner_index;
+		if(seg>len)
+			seg=len;
+		if(stream)
+			stream_copy((void*)(mem->addrs[block_index]+inner_index),buf,seg);
 		else
-		{
-			free_pages(mem->addrs[i],BIGMEM_MAX_ORDER);
-			mem->addrs[i]=0;
-		}
+			memcpy((void*)(mem->addrs[block_index]+inner_index),buf,seg);
+		clear_block_crc(mem,block_index);
+		buf=(const char*)buf+seg;
+		len-=seg;
+		block_index++;
+		inner_index=0;
 	}
-clean_addrs:
-	if(mem->addrs!=NULL)
-		kfree(mem->addrs);
-	if(mem->sizes!=NULL)
-		kfree(mem->sizes);
-	mem->addrs=NULL;
-	mem->sizes=NULL;
-	return err;
+	if(stream)
+		stream_fence();
+	mark_dirty(mem,begin,total);
 }
-EXPORT_SYMBOL(init_bigmem);
 
-/// @brief 清除bigmem结构
-void clean_bigmem(struct big_mem *mem)
+/// @brief 从内存坐标(block_index,inner_index)开始,逐块读取数据到缓冲区
+static void copy_from_blocks(struct big_mem *mem,unsigned long block_index,size_t inner_index,void *buf,size_t len)
 {
-	int i=0;
-	if(NULL==mem)
-		return;
-	/// 释放内存
-	for(i=0;i<mem->mem_count;i++)
+	while(len>0)
+	{
+		size_t seg=mem->sizes[block_index]-inner_index;
+		if(seg>len)
+			seg=len;
+		memcpy(buf,(void*)(mem->addrs[block_index]+inner_index),seg);
+		buf=(char*)buf+seg;
+		len-=seg;
+		block_index++;
+		inner_index=0;
+	}
+}
+
+/// @brief 从内存坐标(block_index,inner_index)开始,逐块设置内存数据
+static void fill_blocks(struct big_mem *mem,unsigned long block_index,size_t inner_index,char data,size_t len)
+{
+	const int stream=use_stream(mem,len);
+	const size_t begin=mem->offsets[block_index]+inner_index;
+	const size_t total=len;
+	while(len>0)
 	{
-		if(i==mem->mem_count-1)
-			free_pages(mem->addrs[i],get_order(mem->sizes[i]));
+		size_t seg=mem->sizes[block_index]-inner_index;
+		if(seg>len)
+			seg=len;
+		if(stream)
+			stream_fill((void*)(mem->addrs[block_index]+inner_index),data,seg);
 		else
-			free_pages(mem->addrs[i],BIGMEM_MAX_ORDER);
+			memset((void*)(mem->addrs[block_index]+inner_index),data,seg);
+		clear_block_crc(mem,block_index);
+		len-=seg;
+		block_index++;
+		inner_index=0;
 	}
-	/// 释放块数组
-	kfree(mem->addrs);
-	kfree(mem->sizes);
-	mem->addrs=mem->sizes=NULL;
+	if(stream)
+		stream_fence();
+	mark_dirty(mem,begin,total);
 }
-EXPORT_SYMBOL(clean_bigmem);
-#endif   /// USER_SPACE
 
+/// @brief 从内存坐标(block_index,inner_index)开始,逐块对比缓冲区数据
+/// @retval 参考memcmp(buf,内存数据)的返回值
+static int cmp_blocks(struct big_mem *mem,unsigned long block_index,size_t inner_index,const void *buf,size_t len)
+{
+	int res=0;
+	while(len>0)
+	{
+		size_t seg=mem->sizes[block_index]-inner_index;
+		if(seg>len)
+			seg=len;
+		if((res=memcmp(buf,(void*)(mem->addrs[block_index]+inner_index),seg))!=0)
+			return res;
+		buf=(const char*)buf+seg;
+		len-=seg;
+		block_index++;
+		inner_index=0;
+	}
+	return 0;
+}
 
-/// @brief 把缓冲区数据写入内存
-/// @param[in] begin,写入到mem的位置
-/// @param[in] buf,缓冲区首地址
-/// @param[in] size, 缓冲区大小
-/// @retval 0成功, <0失败
-int write_bigmem(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size)
+/// @brief 计算内存位置begin的坐标,位于block_index所在内存块时不重新查找
+/// @param[in,out] block_index 上一次所在的内存块,首次调用时传入mem_count
+static inline void seek_bigmem_coord(struct big_mem *mem,size_t begin,unsigned long *block_index,size_t *inner_index)
 {
-	int err=0;
-	if(NULL==mem)
-		return -EINVAL;
-#ifndef USER_SPACE
-	write_lock(&mem->lock);
-#endif
-	err=_write_bigmem(mem,begin,buf,buf_size);
-#ifndef USER_SPACE
-	write_unlock(&mem->lock);
-#endif
-	return err;
+	if(*block_index<mem->mem_count&&begin>=mem->offsets[*block_index]&&begin<mem->offsets[*block_index+1])
+		*inner_index=begin-mem->offsets[*block_index];
+	else
+		cal_bigmem_coord(mem,begin,block_index,inner_index);
 }
-#ifndef USER_SPACE
-EXPORT_SYMBOL(write_bigmem);
-#endif
 
-/// @brief 读取数据到缓冲区
-/// @param[in] begin,读取数据的mem的位置
-/// @param[in] buf,缓冲区首地址
-/// @param[in] size, 缓冲区大小
-/// @retval 0成功, <0失败
-int read_bigmem(struct big_mem *mem,size_t begin,void *buf,size_t buf_size)
+/// @brief 检查批量操作的每一项,并计算各项的总长度
+/// @retval 0成功 <0失败
+static int check_bigmem_vec(struct big_mem *mem,const struct bigmem_vec *vec,int count,size_t *len)
 {
+	size_t total=0;
+	int i=0;
 	int err=0;
-	if(NULL==mem)
+	if(NULL==mem||(NULL==vec&&count!=0)||count<0)
 		return -EINVAL;
-#ifndef USER_SPACE
-	read_lock(&mem->lock);
-#endif
-	err=_read_bigmem(mem,begin,buf,buf_size);
-#ifndef USER_SPACE
-	read_unlock(&mem->lock);
+	for(i=0;i<count;i++)
+	{
+		if(0==vec[i].len)
+			continue;
+		if((err=check_bigmem_range(mem,vec[i].begin,vec[i].len))<0)
+			return err;
+		total+=vec[i].len;
+	}
+	*len=total;
+	return 0;
+}
+
+#define BIGMEM_LOCK_WRITE 0x1   ///< 加写锁
+#define BIGMEM_LOCK_BH 0x2      ///< 同时禁止软中断
+#define BIGMEM_LOCK_BATCH 0x4   ///< 超过BIGMEM_LOCK_NEST个分段时只锁住开头一批,不要求整个操作原子
+
+#define BIGMEM_VEC_READ 0    ///< 批量读取
+#define BIGMEM_VEC_WRITE 1   ///< 批量写入
+#define BIGMEM_VEC_SET 2     ///< 批量设置
+#define BIGMEM_VEC_CMP 3     ///< 批量对比
+
+/// @brief 依次执行批量操作,相邻项位于同一内存块时沿用上一项的坐标
+/// @param[out] res BIGMEM_VEC_CMP时为第一个不相等项的memcmp结果
+static void _vec_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count,int op,char data,int *res)
+{
+	unsigned long block_index=mem->mem_count;
+	size_t inner_index=0;
+	int i=0;
+	for(i=0;i<count;i++)
+	{
+		if(0==vec[i].len)
+			continue;
+		seek_bigmem_coord(mem,vec[i].begin,&block_index,&inner_index);
+		stat_bigmem_op(mem,op,vec[i].len,inner_index+vec[i].len>mem->sizes[block_index]);
+		trace_bigmem_op(mem,op,vec[i].begin,vec[i].len,block_index);
+		switch(op)
+		{
+		case BIGMEM_VEC_WRITE:
+			copy_to_blocks(mem,block_index,inner_index,vec[i].buf,vec[i].len);
+			break;
+		case BIGMEM_VEC_SET:
+			fill_blocks(mem,block_index,inner_index,data,vec[i].len);
+			break;
+		case BIGMEM_VEC_CMP:
+			if((*res=cmp_blocks(mem,block_index,inner_index,vec[i].buf,vec[i].len))!=0)
+				return;
+			break;
+		default:
+			copy_from_blocks(mem,block_index,inner_index,vec[i].buf,vec[i].len);
+			break;
+		}
+	}
+}
+
+#ifndef USER_SPACE
+/// @brief 锁分段,保护一组连续的内存块
+struct bigmem_stripe
+{
+	rwlock_t lock;          ///< 锁
+	seqcount_rwlock_t seq;  ///< 写者持有lock时递增的序列号,供无锁读使用
+} ____cacheline_aligned_in_smp;
+
+/// 一次最多持有的锁分段数,不超过lockdep的子类数MAX_LOCKDEP_SUBCLASSES
+#define BIGMEM_LOCK_NEST 8
+
+#ifndef write_lock_nested
+#define write_lock_nested(lock,subclass) write_lock(lock)
+#endif
+
+/// @brief 一次加锁的锁分段,连续范围[first,last]或升序排列的set
+struct bigmem_range
+{
+	unsigned long first;
+	unsigned long last;
+	size_t len;   ///< 加锁覆盖的字节数,从begin开始
+	const unsigned long *set;   ///< 非NULL时加锁set中的count个分段,忽略first,last
+	unsigned int count;
+	int whole;   ///< 非0时独占整个实例的big_lock,不再获取锁分段
+#ifdef BIGMEM_STATS
+	u64 lock_ns;   ///< 获得锁的时间,0表示未统计
+#endif
+};
+
+/// @brief 计算[begin,begin+len)涉及的锁分段,len为0时范围为空
+/// @retval 0成功 <0失败
+static inline int cal_bigmem_range(struct big_mem *mem,size_t begin,size_t len,struct bigmem_range *range)
+{
+	unsigned long block_index=0;
+	int err=0;
+	range->first=1;
+	range->last=0;
+	range->len=len;
+	range->set=NULL;
+	range->count=0;
+	range->whole=0;
+	if(0==len)
+		return 0;
+	if((err=check_bigmem_range(mem,begin,len))<0)
+		return err;
+	cal_bigmem_coord(mem,begin,&block_index,NULL);
+	range->first=block_index>>mem->stripe_shift;
+	cal_bigmem_coord(mem,begin+len-1,&block_index,NULL);
+	range->last=block_index>>mem->stripe_shift;
+	return 0;
+}
+
+/// @brief range中第i个锁分段
+static inline unsigned long range_stripe(const struct bigmem_range *range,unsigned int i)
+{
+	return NULL!=range->set?range->set[i]:range->first+i;
+}
+
+/// @brief range中锁分段的个数
+static inline unsigned int range_stripes(const struct bigmem_range *range)
+{
+	if(NULL!=range->set)
+		return range->count;
+	return range->first<=range->last?range->last-range->first+1:0;
+}
+
+/// @brief 按升序获取range中的锁分段,个数不能超过BIGMEM_LOCK_NEST
+/// @note 先获取实例的big_lock读锁,再获取锁分段;range->whole非0时只获取big_lock写锁,
+/// 排斥所有锁分段的持有者
+static void lock_bigmem_stripes(struct big_mem *mem,struct bigmem_range *range,int mode)
+{
+	unsigned int count=range_stripes(range);
+	unsigned int i=0;
+#ifdef BIGMEM_STATS
+	u64 start=0;
+	range->lock_ns=0;
+#endif
+	if(0==count&&!range->whole)
+		return;
+#ifdef BIGMEM_STATS
+	if(NULL!=mem->stats)
+		start=ktime_get_ns();
+#endif
+	if(mode&BIGMEM_LOCK_BH)
+		local_bh_disable();
+	if(range->whole)
+	{
+		write_lock(&mem->big_lock);
+		if(mode&BIGMEM_LOCK_WRITE)
+			write_seqcount_begin(&mem->big_seq);
+		count=0;
+	}
+	else
+		read_lock(&mem->big_lock);
+	for(i=0;i<count;i++)
+	{
+		struct bigmem_stripe *stripe=&mem->stripes[range_stripe(range,i)];
+		if(mode&BIGMEM_LOCK_WRITE)
+		{
+			/// 同一批内的分段使用不同的lockdep子类
+			write_lock_nested(&stripe->lock,i);
+			write_seqcount_begin_nested(&stripe->seq,i);
+		}
+		else
+			read_lock(&stripe->lock);
+	}
+#ifdef BIGMEM_STATS
+	if(0!=start)
+	{
+		range->lock_ns=ktime_get_ns();
+		this_cpu_inc(mem->stats->lock_wait[stat_bucket(range->lock_ns-start)]);
+	}
+#endif
+}
+
+/// @brief 按升序获取[begin,begin+len)涉及的锁分段
+/// @note 超过BIGMEM_LOCK_NEST个分段时独占整个实例,保证整个操作原子;
+/// mode含BIGMEM_LOCK_BATCH时改为只锁住开头BIGMEM_LOCK_NEST个分段,
+/// 加锁覆盖的长度保存在range->len,不足len时调用者在解锁后从begin+range->len继续
+/// @param[in] mode BIGMEM_LOCK_WRITE,BIGMEM_LOCK_BH,BIGMEM_LOCK_BATCH的组合
+/// @retval 0成功 <0失败(未加锁)
+static int lock_bigmem(struct big_mem *mem,size_t begin,size_t len,int mode,struct bigmem_range *range)
+{
+	int err=0;
+#ifdef BIGMEM_STATS
+	range->lock_ns=0;
+#endif
+	if((err=cal_bigmem_range(mem,begin,len,range))<0)
+	{
+		stat_bigmem_error(mem);
+		return err;
+	}
+	if(range->first<=range->last&&range->last-range->first>=BIGMEM_LOCK_NEST)
+	{
+		if(mode&BIGMEM_LOCK_BATCH)
+		{
+			/// 截断到BIGMEM_LOCK_NEST个分段,在下一分段的起点处结束
+			range->last=range->first+BIGMEM_LOCK_NEST-1;
+			range->len=mem->offsets[(range->last+1)<<mem->stripe_shift]-begin;
+		}
+		else
+			range->whole=1;
+	}
+	lock_bigmem_stripes(mem,range,mode);
+	return 0;
+}
+
+/// @brief 按降序释放lock_bigmem或lock_bigmem_stripes获取的锁分段
+static void unlock_bigmem(struct big_mem *mem,const struct bigmem_range *range,int mode)
+{
+	unsigned int i=range_stripes(range);
+	if(0==i&&!range->whole)
+		return;
+#ifdef BIGMEM_STATS
+	/// 在释放锁之前记录,保证stats未被停用
+	if(0!=range->lock_ns)
+		this_cpu_inc(mem->stats->lock_hold[stat_bucket(ktime_get_ns()-range->lock_ns)]);
+#endif
+	if(range->whole)
+	{
+		if(mode&BIGMEM_LOCK_WRITE)
+			write_seqcount_end(&mem->big_seq);
+		write_unlock(&mem->big_lock);
+		i=0;
+	}
+	while(i-->0)
+	{
+		struct bigmem_stripe *stripe=&mem->stripes[range_stripe(range,i)];
+		if(mode&BIGMEM_LOCK_WRITE)
+		{
+			write_seqcount_end(&stripe->seq);
+			write_unlock(&stripe->lock);
+		}
+		else
+			read_unlock(&stripe->lock);
+	}
+	if(!range->whole)
+		read_unlock(&mem->big_lock);
+	if(mode&BIGMEM_LOCK_BH)
+		local_bh_enable();
+}
+
+/// @brief 开始无锁读,返回实例和范围内各分段序列号之和
+/// @note 序列号只增不减,和不变即说明期间没有写者;独占整个实例的写者递增big_seq
+static inline unsigned int read_bigmem_seq_begin(struct big_mem *mem,const struct bigmem_range *range)
+{
+	unsigned int seq=read_seqcount_begin(&mem->big_seq);
+	unsigned long i=0;
+	for(i=range->first;i<=range->last;i++)
+		seq+=read_seqcount_begin(&mem->stripes[i].seq);
+	return seq;
+}
+
+/// @brief 判断无锁读期间是否有写者,需要重试
+static inline int read_bigmem_seq_retry(struct big_mem *mem,const struct bigmem_range *range,unsigned int seq)
+{
+	unsigned int now=0;
+	unsigned long i=0;
+	smp_rmb();
+	now=raw_read_seqcount(&mem->big_seq);
+	for(i=range->first;i<=range->last;i++)
+		now+=raw_read_seqcount(&mem->stripes[i].seq);
+	return now!=seq;
+}
+
+/// @brief 分配并初始化锁分段
+/// @retval 0成功 <0失败
+static int init_bigmem_stripes(struct big_mem *mem,unsigned int shift)
+{
+	unsigned long i=0;
+	if(shift>=BITS_PER_LONG)
+		return -EINVAL;
+	mem->stripe_shift=shift;
+	mem->stripe_count=((mem->mem_count-1)>>shift)+1;
+	mem->stripes=(struct bigmem_stripe*)kvcalloc(mem->stripe_count,sizeof(struct bigmem_stripe),GFP_KERNEL);
+	if(NULL==mem->stripes)
+		return -ENOMEM;
+	rwlock_init(&mem->big_lock);
+	seqcount_rwlock_init(&mem->big_seq,&mem->big_lock);
+	for(i=0;i<mem->stripe_count;i++)
+	{
+		rwlock_init(&mem->stripes[i].lock);
+		seqcount_rwlock_init(&mem->stripes[i].seq,&mem->stripes[i].lock);
+	}
+	return 0;
+}
+#endif   /// USER_SPACE
+
+static int _write_bigmem(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size)
+{
+	unsigned long block_index;  ///< 起始内存块索引
+	size_t inner_index;    ///< 起始内存内索引
+	int err=0;
+	if(NULL==mem)
+		return -EINVAL;
+	if(0==buf_size)
+		return 0;
+	if((err=check_bigmem_range(mem,begin,buf_size))<0)
+	{
+		stat_bigmem_error(mem);
+		return err;
+	}
+	if((err=cal_bigmem_coord(mem,begin,&block_index,&inner_index))<0)
+		return err;
+	/// 内存拷贝,可跨越任意多个内存块
+	copy_to_blocks(mem,block_index,inner_index,buf,buf_size);
+	return 0;
+}
+
+/// @brief 读取数据到缓冲区
+static int _read_bigmem(struct big_mem *mem,size_t begin,void *buf,size_t buf_size)
+{
+	unsigned long block_index;  ///< 起始内存块索引
+	size_t inner_index;    ///< 起始内存内索引
+	int err=0;
+	if(NULL==mem)
+		return -EINVAL;
+	if(0==buf_size)
+		return 0;
+	/// 计算起始地址内存坐标
+	if((err=check_bigmem_range(mem,begin,buf_size))<0)
+	{
+		stat_bigmem_error(mem);
+		return err;
+	}
+	if((err=cal_bigmem_coord(mem,begin,&block_index,&inner_index))<0)
+		return err;
+	/// 复制数据到buf,可跨越任意多个内存块
+	copy_from_blocks(mem,block_index,inner_index,buf,buf_size);
+	return 0;
+}
+
+/// @brief 设置内存数据为data
+static int _set_bigmem(struct big_mem *mem,size_t begin,size_t len,char data)
+{
+	unsigned long block_index;  ///< 起始内存块索引
+	size_t inner_index;    ///< 起始内存内索引
+	int err=0;
+
+	if(NULL==mem)
+		return -EINVAL;
+	if(0==len)
+		return 0;
+	if((err=check_bigmem_range(mem,begin,len))<0)
+	{
+		stat_bigmem_error(mem);
+		return err;
+	}
+	if((err=cal_bigmem_coord(mem,begin,&block_index,&inner_index))<0)
+		return err;
+	/// 设置内存值
+	fill_blocks(mem,block_index,inner_index,data,len);
+	return 0;
+}
+
+/// 查找不相等字节时,每次用memcmp跳过的块大小
+#define MISMATCH_CHUNK 256
+
+/// @brief 返回buf与data前len字节中第一个不相等字节的位置,全部相等时返回len
+static size_t mismatch_bytes(const unsigned char *buf,const unsigned char *data,size_t len)
+{
+	size_t i=0;
+	/// 用memcmp整块跳过相等部分,再在不相等的块内逐字节定位
+	while(len-i>=MISMATCH_CHUNK&&memcmp(buf+i,data+i,MISMATCH_CHUNK)==0)
+		i+=MISMATCH_CHUNK;
+	while(i<len&&buf[i]==data[i])
+		i++;
+	return i;
+}
+
+/// @brief 从内存坐标(block_index,inner_index)开始逐块对比,并定位第一个不相等的字节
+/// @param[out] diff 第一个不相等字节相对于起点的位置,全部相等时为len
+/// @retval 参考memcmp(buf,内存数据)的返回值
+static int mismatch_blocks(struct big_mem *mem,unsigned long block_index,size_t inner_index,const void *buf,size_t len,size_t *diff)
+{
+	const unsigned char *p=(const unsigned char*)buf;
+	size_t done=0;
+	while(done<len)
+	{
+		const unsigned char *data=(const unsigned char*)(mem->addrs[block_index]+inner_index);
+		size_t seg=mem->sizes[block_index]-inner_index;
+		size_t i=0;
+		if(seg>len-done)
+			seg=len-done;
+		if((i=mismatch_bytes(p+done,data,seg))<seg)
+		{
+			*diff=done+i;
+			return p[done+i]<data[i]?-1:1;
+		}
+		done+=seg;
+		block_index++;
+		inner_index=0;
+	}
+	*diff=len;
+	return 0;
+}
+
+/// @brief 对比内存缓冲区的数据
+/// @param[out] res比较结果
+/// @param[out] diff 第一个不相等字节在mem中的位置,全部相等时为begin+buf_size,可为NULL
+static int _cmp_bigmem(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res,size_t *diff)
+{
+	unsigned long block_index;  ///< 起始内存块索引
+	size_t inner_index;    ///< 起始内存内索引
+	int err=0;
+
+	if(NULL==mem)
+		return -EINVAL;
+	if(NULL==res)
+		return -EINVAL;
+	*res=0;
+	if(NULL!=diff)
+		*diff=begin+buf_size;
+	if(0==buf_size)
+		return 0;
+	if((err=check_bigmem_range(mem,begin,buf_size))<0)
+	{
+		stat_bigmem_error(mem);
+		return err;
+	}
+	if((err=cal_bigmem_coord(mem,begin,&block_index,&inner_index))<0)
+		return err;
+	/// 内存对比,覆盖所有内存块,遇到不相等时提前结束
+	if(NULL==diff)
+		*res=cmp_blocks(mem,block_index,inner_index,buf,buf_size);
+	else
+	{
+		size_t pos=0;
+		*res=mismatch_blocks(mem,block_index,inner_index,buf,buf_size,&pos);
+		*diff=begin+pos;
+	}
+	return 0;
+}
+
+#ifndef USER_SPACE
+/// @brief 按NUMA策略分配一个内存块
+/// @param[in] node 期望的节点,仅BIGMEM_NUMA_BIND和BIGMEM_NUMA_INTERLEAVE使用
+/// @param[out] nid 内存块实际所在的节点
+/// @retval 内存块首地址,0表示失败
+static unsigned long alloc_bigmem_block(gfp_t flags,unsigned int order,int policy,int node,int *nid)
+{
+	struct page *page=NULL;
+	/// 与__get_free_pages相同,不使用高端内存
+	flags&=~__GFP_HIGHMEM;
+	/// 复合页的尾页可以单独增加引用计数,splice时直接引用内存块中的页
+	flags|=__GFP_COMP;
+	switch(policy)
+	{
+	case BIGMEM_NUMA_BIND:
+		page=alloc_pages_node(node,flags|__GFP_THISNODE,order);
+		break;
+	case BIGMEM_NUMA_INTERLEAVE:
+		page=alloc_pages_node(node,flags,order);
+		break;
+	case BIGMEM_NUMA_LOCAL:
+		page=alloc_pages_node(numa_node_id(),flags,order);
+		break;
+	default:
+		page=alloc_pages(flags,order);
+		break;
+	}
+	if(NULL==page)
+		return 0;
+	*nid=page_to_nid(page);
+	return (unsigned long)page_address(page);
+}
+
+/// @brief 初始化bigmem结构
+/// @param[in] size 内存大小
+/// @retval 0成功,<0失败
+int init_bigmem(struct big_mem *mem,size_t mem_size,gfp_t flags)
+{
+	return init_bigmem_attr(mem,mem_size,flags,NULL);
+}
+EXPORT_SYMBOL(init_bigmem);
+
+/// @brief 按属性初始化bigmem结构
+/// @param[in] size 内存大小
+/// @param[in] attr 创建属性,NULL使用默认值
+/// @retval 0成功,<0失败
+int init_bigmem_attr(struct big_mem *mem,size_t mem_size,gfp_t flags,const struct bigmem_attr *attr)
+{
+	int err=0;   ///< 错误码
+	unsigned long block_count=0;   ///< 内存块
+	size_t left=mem_size;   ///< 待分配大小
+	unsigned int order=BIGMEM_MAX_ORDER;   ///< 整块的order值
+	int policy=BIGMEM_NUMA_ANY;   ///< NUMA放置策略
+	int node=NUMA_NO_NODE;   ///< 分配的节点
+	unsigned long i;
+	unsigned long mem_index=0;
+	u64 start=trace_bigmem_init_enabled()?ktime_get_ns():0;   ///< 跟踪点启用时记录分配耗时,0表示开始时未启用
+	
+	/// 判断参数,失败时同样触发跟踪点
+	if(NULL==mem)
+	{
+		err=-EINVAL;
+		goto trace;
+	}
+	if(NULL!=attr&&attr->block_order!=0)
+		order=attr->block_order;
+	/// 默认order超过本内核的上限时使用上限,只拒绝调用者指定的order
+	else if(order>BIGMEM_PAGE_ORDER_LIMIT)
+		order=BIGMEM_PAGE_ORDER_LIMIT;
+	if(order>BIGMEM_PAGE_ORDER_LIMIT)
+	{
+		err=-EINVAL;
+		goto trace;
+	}
+	if(NULL!=attr)
+		policy=attr->numa_policy;
+	if(policy<BIGMEM_NUMA_ANY||policy>BIGMEM_NUMA_LOCAL)
+	{
+		err=-EINVAL;
+		goto trace;
+	}
+	if(BIGMEM_NUMA_BIND==policy)
+	{
+		node=attr->numa_node;
+		if(node<0||node>=MAX_NUMNODES||!node_online(node))
+		{
+			err=-EINVAL;
+			goto trace;
+		}
+	}
+	if((err=mem_count(mem_size,order,&block_count))<0)
+		goto trace;
+	/// 初始化内存块
+	err=0;
+	mem->mem_size=mem_size;
+	mem->mem_count=block_count;
+	mem->offsets=NULL;
+	mem->nodes=NULL;
+	mem->block_crcs=NULL;
+	mem->crc_valid=NULL;
+	mem->stream_threshold=0;
+	mem->dirty=NULL;
+	mem->dirty_words=0;
+	mem->dirty_shift=0;
+	mem->base=NULL;
+	mem->base_size=0;
+	RCU_INIT_POINTER(mem->dev,NULL);
+	mem->stripes=NULL;
+	mem->stats=NULL;
+	mem->stats_file=NULL;
+	mem->addrs=(unsigned long*)bigmem_malloc(sizeof(unsigned long)*mem->mem_count);
+	mem->sizes=(size_t*)bigmem_malloc(sizeof(size_t)*mem->mem_count);
+	mem->nodes=(int*)bigmem_malloc(sizeof(int)*mem->mem_count);
+	if(NULL==mem->addrs||NULL==mem->sizes||NULL==mem->nodes)
+	{
+		err=-ENOMEM;
+		goto clean_addrs;
+	}
+	/// 分配内存
+	for(mem_index=0;mem_index<mem->mem_count;mem_index++)
+	{
+		size_t size=next_block_size(left,order);
+		u64 block_start=trace_bigmem_alloc_block_enabled()?ktime_get_ns():0;
+		/// 轮询在线节点
+		if(BIGMEM_NUMA_INTERLEAVE==policy)
+		{
+			node=mem_index==0?NUMA_NO_NODE:node;
+			node=node==NUMA_NO_NODE?first_online_node:next_online_node(node);
+			if(node>=MAX_NUMNODES)
+				node=first_online_node;
+		}
+		if((mem->addrs[mem_index]=alloc_bigmem_block(flags,get_order(size),policy,node,&mem->nodes[mem_index]))==0)
+		{
+			err=-ENOMEM;
+			goto clean_pages;
+		}
+		if(0!=block_start&&trace_bigmem_alloc_block_enabled())
+			trace_bigmem_alloc_block(mem,mem_index,get_order(size),mem->nodes[mem_index],ktime_get_ns()-block_start);
+		mem->sizes[mem_index]=size;
+		left-=size;
+	}
+	/// 建立块索引
+	if((err=index_bigmem(mem))<0)
+		goto clean_pages;
+	/// 初始化锁
+	if((err=init_bigmem_stripes(mem,NULL!=attr?attr->lock_stripe_shift:0))<0)
+		goto clean_offsets;
+	goto trace;
+clean_offsets:
+	bigmem_free(mem->offsets);
+	mem->offsets=NULL;
+clean_pages:
+	for(i=0;i<mem_index;i++)
+	{
+		free_pages(mem->addrs[i],get_order(mem->sizes[i]));
+		mem->addrs[i]=0;
+	}
+clean_addrs:
+	bigmem_free(mem->addrs);
+	bigmem_free(mem->sizes);
+	bigmem_free(mem->nodes);
+	mem->addrs=NULL;
+	mem->sizes=NULL;
+	mem->nodes=NULL;
+trace:
+	/// 中途启用的跟踪点没有开始时间,不输出
+	if(0!=start&&trace_bigmem_init_enabled())
+		trace_bigmem_init(mem,mem_size,block_count,ktime_get_ns()-start,err);
+	return err;
+}
+EXPORT_SYMBOL(init_bigmem_attr);
+
+/// @brief 清除bigmem结构
+void clean_bigmem(struct big_mem *mem)
+{
+	unsigned long i=0;
+	if(NULL==mem)
+		return;
+	trace_bigmem_clean(mem,mem->mem_size,mem->mem_count);
+	/// 注销字符设备,取消连续映射
+	unregister_bigmem_dev(mem);
+	vunmap_bigmem(mem);
+	/// 释放内存
+	for(i=0;i<mem->mem_count;i++)
+		free_pages(mem->addrs[i],get_order(mem->sizes[i]));
+	/// 释放块数组
+	disable_bigmem_crc(mem);
+	disable_bigmem_dirty(mem);
+	disable_bigmem_stats(mem);
+	bigmem_free(mem->addrs);
+	bigmem_free(mem->sizes);
+	bigmem_free(mem->offsets);
+	bigmem_free(mem->nodes);
+	kvfree(mem->stripes);
+	mem->addrs=NULL;
+	mem->sizes=NULL;
+	mem->offsets=NULL;
+	mem->nodes=NULL;
+	mem->stripes=NULL;
+}
+EXPORT_SYMBOL(clean_bigmem);
+
+/// @brief 返回已分配但未使用的物理内存字节数
+size_t get_bigmem_overhead(const struct big_mem *mem)
+{
+	size_t total=0;
+	unsigned long i=0;
+	if(NULL==mem||NULL==mem->sizes)
+		return 0;
+	for(i=0;i<mem->mem_count;i++)
+		total+=PAGE_SIZE<<get_order(mem->sizes[i]);
+	return total-mem->mem_size;
+}
+EXPORT_SYMBOL(get_bigmem_overhead);
+
+static struct dentry *bigmem_debugfs;   ///< debugfs目录bigmem
+
+#ifdef BIGMEM_STATS
+static int bigmem_stats_show(struct seq_file *seq,void *data)
+{
+	static const char *names[BIGMEM_STAT_OPS]={"read","write","set","cmp"};
+	struct bigmem_stats stats;
+	int i=0;
+	if(get_bigmem_stats((struct big_mem*)seq->private,&stats)<0)
+		return -ENODATA;
+	for(i=0;i<BIGMEM_STAT_OPS;i++)
+		seq_printf(seq,"%s_ops %llu\n%s_bytes %llu\n",names[i],stats.ops[i],names[i],stats.bytes[i]);
+	seq_printf(seq,"cross_block %llu\nerrors %llu\n",stats.cross_block,stats.errors);
+	/// 直方图每行依次为2^0..2^31纳秒各桶的计数
+	seq_puts(seq,"lock_wait_ns_log2");
+	for(i=0;i<BIGMEM_STAT_BUCKETS;i++)
+		seq_printf(seq," %llu",stats.lock_wait[i]);
+	seq_puts(seq,"\nlock_hold_ns_log2");
+	for(i=0;i<BIGMEM_STAT_BUCKETS;i++)
+		seq_printf(seq," %llu",stats.lock_hold[i]);
+	seq_putc(seq,'\n');
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bigmem_stats);
+#endif   /// BIGMEM_STATS
+
+/// @brief 启用统计,并创建debugfs文件bigmem/name
+/// @retval 0成功 <0失败
+int enable_bigmem_stats(struct big_mem *mem,const char *name)
+{
+#ifdef BIGMEM_STATS
+	if(NULL==mem||NULL==name)
+		return -EINVAL;
+	if(NULL!=mem->stats)
+		return -EBUSY;
+	mem->stats=alloc_percpu(struct bigmem_stats);
+	if(NULL==mem->stats)
+		return -ENOMEM;
+	/// debugfs不可用时仍可通过get_bigmem_stats读取
+	mem->stats_file=debugfs_create_file(name,0444,bigmem_debugfs,mem,&bigmem_stats_fops);
+	if(IS_ERR(mem->stats_file))
+		mem->stats_file=NULL;
+	return 0;
+#else    /// BIGMEM_STATS
+	return -EOPNOTSUPP;
+#endif   /// BIGMEM_STATS
+}
+EXPORT_SYMBOL(enable_bigmem_stats);
+
+/// @brief 停用统计并删除debugfs文件
+void disable_bigmem_stats(struct big_mem *mem)
+{
+	if(NULL==mem)
+		return;
+	debugfs_remove(mem->stats_file);
+	free_percpu(mem->stats);
+	mem->stats_file=NULL;
+	mem->stats=NULL;
+}
+EXPORT_SYMBOL(disable_bigmem_stats);
+
+/// @brief 汇总各CPU的统计
+/// @retval 0成功 <0未启用统计
+int get_bigmem_stats(struct big_mem *mem,struct bigmem_stats *stats)
+{
+	int cpu=0;
+	int i=0;
+	if(NULL==mem||NULL==stats)
+		return -EINVAL;
+	if(NULL==mem->stats)
+		return -ENODATA;
+	memset(stats,0,sizeof(*stats));
+	for_each_possible_cpu(cpu)
+	{
+		const struct bigmem_stats *percpu=per_cpu_ptr(mem->stats,cpu);
+		for(i=0;i<BIGMEM_STAT_OPS;i++)
+		{
+			stats->ops[i]+=READ_ONCE(percpu->ops[i]);
+			stats->bytes[i]+=READ_ONCE(percpu->bytes[i]);
+		}
+		stats->cross_block+=READ_ONCE(percpu->cross_block);
+		stats->errors+=READ_ONCE(percpu->errors);
+		for(i=0;i<BIGMEM_STAT_BUCKETS;i++)
+		{
+			stats->lock_wait[i]+=READ_ONCE(percpu->lock_wait[i]);
+			stats->lock_hold[i]+=READ_ONCE(percpu->lock_hold[i]);
+		}
+	}
+	return 0;
+}
+EXPORT_SYMBOL(get_bigmem_stats);
+
+/// @brief 将所有内存块映射到一段连续的内核虚拟地址
+/// @retval 0成功,<0失败
+int vmap_bigmem(struct big_mem *mem)
+{
+	struct page **pages=NULL;
+	unsigned long page_count=0;
+	unsigned long page_index=0;
+	unsigned long i=0;
+	if(NULL==mem||NULL==mem->addrs||NULL==mem->sizes)
+		return -EINVAL;
+	if(NULL!=mem->base)
+		return 0;
+	/// 除末块外,内存块须按页对齐才能首尾相接
+	for(i=0;i+1<mem->mem_count;i++)
+		if(mem->sizes[i]&~PAGE_MASK)
+			return -EINVAL;
+	/// 收集各内存块的页
+	page_count=PAGE_ALIGN(mem->mem_size)>>PAGE_SHIFT;
+	pages=kvmalloc_array(page_count,sizeof(struct page*),GFP_KERNEL);
+	if(NULL==pages)
+		return -ENOMEM;
+	for(i=0;i<mem->mem_count;i++)
+	{
+		struct page *page=virt_to_page((void*)mem->addrs[i]);
+		unsigned long j=0;
+		for(j=0;j<PAGE_ALIGN(mem->sizes[i])>>PAGE_SHIFT;j++)
+			pages[page_index++]=page+j;
+	}
+	/// 建立连续映射
+	mem->base=vmap(pages,page_index,VM_MAP,PAGE_KERNEL);
+	kvfree(pages);
+	if(NULL==mem->base)
+		return -ENOMEM;
+	mem->base_size=page_index<<PAGE_SHIFT;
+	return 0;
+}
+EXPORT_SYMBOL(vmap_bigmem);
+
+/// @brief 取消vmap_bigmem建立的连续映射
+void vunmap_bigmem(struct big_mem *mem)
+{
+	if(NULL==mem||NULL==mem->base)
+		return;
+	vunmap(mem->base);
+	mem->base=NULL;
+	mem->base_size=0;
+}
+EXPORT_SYMBOL(vunmap_bigmem);
+
+/// @brief bigmem字符设备
+/// @note 注册时持有一个引用,每个打开的文件和映射的vma各持有一个引用;
+/// 注销后mem置为NULL,已打开的文件返回-ENODEV,映射的内存块在最后一个vma关闭后才释放
+struct bigmem_dev
+{
+	struct miscdevice misc;   ///< misc设备
+	struct big_mem __rcu *mem;   ///< 对应的bigmem,注销后为NULL
+	struct kref ref;          ///< 引用计数
+	struct page **pages;      ///< 各内存块的首页,映射时对其增加引用
+	unsigned long page_count;
+	char name[32];            ///< 设备名
+	wait_queue_head_t wait;   ///< 等待数据发布的进程
+	atomic64_t bytes;         ///< 累计发布的字节数
+	atomic64_t records;       ///< 累计发布的记录数
+};
+
+/// 保护bigmem_dev::mem和big_mem::dev,读侧可以睡眠
+DEFINE_STATIC_SRCU(bigmem_dev_srcu);
+
+static void release_bigmem_dev(struct kref *ref)
+{
+	struct bigmem_dev *dev=container_of(ref,struct bigmem_dev,ref);
+	kvfree(dev->pages);
+	kfree(dev);
+}
+
+/// @brief 开始访问设备对应的bigmem
+/// @retval 设备已注销时返回NULL,仍须调用put_dev_mem
+static struct big_mem *get_dev_mem(struct bigmem_dev *dev,int *idx)
+{
+	*idx=srcu_read_lock(&bigmem_dev_srcu);
+	return srcu_dereference(dev->mem,&bigmem_dev_srcu);
+}
+
+static void put_dev_mem(int idx)
+{
+	srcu_read_unlock(&bigmem_dev_srcu,idx);
+}
+
+/// @brief 打开字符设备的文件状态
+struct bigmem_file
+{
+	struct bigmem_dev *dev;   ///< 字符设备
+	__u64 bytes_seen;         ///< 已确认的字节数
+	__u64 records_seen;       ///< 已确认的记录数
+	struct bigmem_event mark; ///< 唤醒水位,为0的项不参与判断
+};
+
+static int bigmem_dev_open(struct inode *inode,struct file *file)
+{
+	struct bigmem_dev *dev=container_of(file->private_data,struct bigmem_dev,misc);
+	struct bigmem_file *bfile=(struct bigmem_file*)kzalloc(sizeof(struct bigmem_file),GFP_KERNEL);
+	if(NULL==bfile)
+		return -ENOMEM;
+	/// misc_open持有misc_mtx调用open,misc_deregister返回后不会再有新的打开
+	kref_get(&dev->ref);
+	bfile->dev=dev;
+	bfile->bytes_seen=atomic64_read(&dev->bytes);
+	bfile->records_seen=atomic64_read(&dev->records);
+	/// 默认每发布一条记录唤醒一次
+	bfile->mark.records=1;
+	file->private_data=bfile;
+	return 0;
+}
+
+static int bigmem_dev_release(struct inode *inode,struct file *file)
+{
+	struct bigmem_file *bfile=(struct bigmem_file*)file->private_data;
+	kref_put(&bfile->dev->ref,release_bigmem_dev);
+	kfree(bfile);
+	return 0;
+}
+
+/// @brief 判断自上次确认以来发布的数据是否达到水位
+static bool bigmem_file_ready(struct bigmem_file *bfile)
+{
+	__u64 bytes=atomic64_read(&bfile->dev->bytes)-bfile->bytes_seen;
+	__u64 records=atomic64_read(&bfile->dev->records)-bfile->records_seen;
+	if(bfile->mark.bytes!=0&&bytes>=bfile->mark.bytes)
+		return true;
+	if(bfile->mark.records!=0&&records>=bfile->mark.records)
+		return true;
+	return false;
+}
+
+static __poll_t bigmem_dev_poll(struct file *file,poll_table *wait)
+{
+	struct bigmem_file *bfile=(struct bigmem_file*)file->private_data;
+	__poll_t mask=0;
+	poll_wait(file,&bfile->dev->wait,wait);
+	if(bigmem_file_ready(bfile))
+		mask|=EPOLLIN|EPOLLRDNORM;
+	if(NULL==rcu_access_pointer(bfile->dev->mem))
+		mask|=EPOLLHUP;
+	return mask;
+}
+
+/// @brief vma持有设备的引用和所有内存块的页引用,clean_bigmem之后内存块仍然有效
+static void bigmem_vma_open(struct vm_area_struct *vma)
+{
+	struct bigmem_dev *dev=(struct bigmem_dev*)vma->vm_private_data;
+	unsigned long i=0;
+	kref_get(&dev->ref);
+	for(i=0;i<dev->page_count;i++)
+		get_page(dev->pages[i]);
+}
+
+static void bigmem_vma_close(struct vm_area_struct *vma)
+{
+	struct bigmem_dev *dev=(struct bigmem_dev*)vma->vm_private_data;
+	unsigned long i=0;
+	for(i=0;i<dev->page_count;i++)
+		put_page(dev->pages[i]);
+	kref_put(&dev->ref,release_bigmem_dev);
+}
+
+static const struct vm_operations_struct bigmem_vm_ops={
+	.open=bigmem_vma_open,
+	.close=bigmem_vma_close,
+};
+
+/// @brief 将所有内存块依次映射到vma中
+static int bigmem_dev_mmap(struct file *file,struct vm_area_struct *vma)
+{
+	struct bigmem_dev *dev=((struct bigmem_file*)file->private_data)->dev;
+	struct big_mem *mem=NULL;
+	size_t len=vma->vm_end-vma->vm_start;
+	size_t offset=0;
+	unsigned long i=0;
+	int idx=0;
+	int err=0;
+	if(NULL==(mem=get_dev_mem(dev,&idx)))
+	{
+		err=-ENODEV;
+		goto out;
+	}
+	if(vma->vm_pgoff!=0||len>PAGE_ALIGN(mem->mem_size))
+	{
+		err=-EINVAL;
+		goto out;
+	}
+	for(i=0;i<mem->mem_count&&offset<len;i++)
+	{
+		size_t size=PAGE_ALIGN(mem->sizes[i]);
+		/// 除末块外,内存块须按页对齐才能首尾相接
+		if(i+1<mem->mem_count&&(mem->sizes[i]&~PAGE_MASK))
+		{
+			err=-EINVAL;
+			goto out;
+		}
+		if(size>len-offset)
+			size=len-offset;
+		err=remap_pfn_range(vma,vma->vm_start+offset,virt_to_phys((void*)mem->addrs[i])>>PAGE_SHIFT,size,vma->vm_page_prot);
+		if(err<0)
+			goto out;
+		offset+=size;
+	}
+	/// 首个vma不会调用vm_ops->open
+	vma->vm_ops=&bigmem_vm_ops;
+	vma->vm_private_data=dev;
+	bigmem_vma_open(vma);
+out:
+	put_dev_mem(idx);
+	return err;
+}
+
+static loff_t bigmem_dev_llseek(struct file *file,loff_t offset,int whence)
+{
+	struct big_mem *mem=NULL;
+	loff_t ret=0;
+	int idx=0;
+	if(NULL==(mem=get_dev_mem(((struct bigmem_file*)file->private_data)->dev,&idx)))
+		ret=-ENODEV;
+	else
+		ret=fixed_size_llseek(file,offset,whence,mem->mem_size);
+	put_dev_mem(idx);
+	return ret;
+}
+
+/// @brief 按内存块整段复制到用户缓冲区
+/// @note 不加锁,与mmap相同,读取期间的并发写入可能部分可见
+static ssize_t bigmem_dev_read_iter(struct kiocb *iocb,struct iov_iter *to)
+{
+	struct big_mem *mem=NULL;
+	unsigned long block_index=0;
+	size_t inner_index=0;
+	size_t len=iov_iter_count(to);
+	ssize_t copied=0;
+	int idx=0;
+	if(iocb->ki_pos<0)
+		return -EINVAL;
+	if(NULL==(mem=get_dev_mem(((struct bigmem_file*)iocb->ki_filp->private_data)->dev,&idx)))
+	{
+		put_dev_mem(idx);
+		return -ENODEV;
+	}
+	if(iocb->ki_pos>=mem->mem_size||0==len)
+	{
+		put_dev_mem(idx);
+		return 0;
+	}
+	if(len>mem->mem_size-iocb->ki_pos)
+		len=mem->mem_size-iocb->ki_pos;
+	cal_bigmem_coord(mem,iocb->ki_pos,&block_index,&inner_index);
+	while(len>0)
+	{
+		size_t seg=mem->sizes[block_index]-inner_index;
+		size_t n=0;
+		if(seg>len)
+			seg=len;
+		n=copy_to_iter((void*)(mem->addrs[block_index]+inner_index),seg,to);
+		copied+=n;
+		if(n<seg)
+			break;
+		len-=seg;
+		block_index++;
+		inner_index=0;
+	}
+	put_dev_mem(idx);
+	if(0==copied)
+		return -EFAULT;
+	iocb->ki_pos+=copied;
+	return copied;
+}
+
+/// @brief 释放splice_to_pipe未放入管道的页,只在splice_to_pipe返回前调用
+static void bigmem_spd_release(struct splice_pipe_desc *spd,unsigned int i)
+{
+	put_page(spd->pages[i]);
+}
+
+/// @brief 将内存块中的页放入管道,不复制数据
+/// @note 管道中的数据在被消费前仍会反映对内存的写入;每次最多放入PIPE_DEF_BUFFERS页
+static ssize_t bigmem_dev_splice_read(struct file *file,loff_t *ppos,struct pipe_inode_info *pipe,size_t len,unsigned int flags)
+{
+	struct big_mem *mem=NULL;
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd={
+		.pages=pages,
+		.partial=partial,
+		.nr_pages_max=PIPE_DEF_BUFFERS,
+		/// 使用内核的ops,管道中的缓冲区在模块卸载后释放时不会调用模块代码
+		.ops=&nosteal_pipe_buf_ops,
+		.spd_release=bigmem_spd_release,
+	};
+	unsigned long block_index=0;
+	size_t inner_index=0;
+	ssize_t ret=0;
+	int idx=0;
+	if(*ppos<0)
+		return -EINVAL;
+	if(NULL==(mem=get_dev_mem(((struct bigmem_file*)file->private_data)->dev,&idx)))
+	{
+		put_dev_mem(idx);
+		return -ENODEV;
+	}
+	if(*ppos>=mem->mem_size||0==len)
+	{
+		put_dev_mem(idx);
+		return 0;
+	}
+	if(len>mem->mem_size-*ppos)
+		len=mem->mem_size-*ppos;
+	cal_bigmem_coord(mem,*ppos,&block_index,&inner_index);
+	while(len>0&&spd.nr_pages<PIPE_DEF_BUFFERS)
+	{
+		void *addr=(void*)(mem->addrs[block_index]+inner_index);
+		size_t offset=offset_in_page(addr);
+		size_t seg=PAGE_SIZE-offset;
+		if(seg>mem->sizes[block_index]-inner_index)
+			seg=mem->sizes[block_index]-inner_index;
+		if(seg>len)
+			seg=len;
+		pages[spd.nr_pages]=virt_to_page(addr);
+		get_page(pages[spd.nr_pages]);
+		partial[spd.nr_pages].offset=offset;
+		partial[spd.nr_pages].len=seg;
+		spd.nr_pages++;
+		len-=seg;
+		inner_index+=seg;
+		if(inner_index==mem->sizes[block_index])
+		{
+			block_index++;
+			inner_index=0;
+		}
+	}
+	/// 已持有页引用,放入管道时不再访问mem
+	put_dev_mem(idx);
+	ret=splice_to_pipe(pipe,&spd);
+	if(ret>0)
+		*ppos+=ret;
+	return ret;
+}
+
+/// @brief 处理ioctl,调用者保证设备未注销
+static long _bigmem_dev_ioctl(struct bigmem_file *bfile,struct big_mem *mem,unsigned int cmd,unsigned long arg)
+{
+	struct bigmem_dev *dev=bfile->dev;
+	switch(cmd)
+	{
+	case BIGMEM_IOC_INFO:
+		{
+			struct bigmem_info info;
+			info.mem_size=mem->mem_size;
+			info.mem_count=mem->mem_count;
+			if(copy_to_user((void __user*)arg,&info,sizeof(info)))
+				return -EFAULT;
+			return 0;
+		}
+	case BIGMEM_IOC_DESC:
+		{
+			struct bigmem_desc_req req;
+			void *data=NULL;
+			size_t len=0;
+			long err=0;
+			if(copy_from_user(&req,(void __user*)arg,sizeof(req)))
+				return -EFAULT;
+			if((err=dump_bigmem_desc(mem,&data,&len))<0)
+				return err;
+			if(req.len<len)
+				err=-ENOSPC;
+			else if(copy_to_user((void __user*)(unsigned long)req.buf,data,len))
+				err=-EFAULT;
+			kvfree(data);
+			req.len=len;
+			if(copy_to_user((void __user*)arg,&req,sizeof(req)))
+				return -EFAULT;
+			return err;
+		}
+	case BIGMEM_IOC_SET_WATERMARK:
+		{
+			if(copy_from_user(&bfile->mark,(void __user*)arg,sizeof(bfile->mark)))
+				return -EFAULT;
+			return 0;
+		}
+	case BIGMEM_IOC_ACK:
+		{
+			struct bigmem_event event;
+			__u64 bytes=atomic64_read(&dev->bytes);
+			__u64 records=atomic64_read(&dev->records);
+			event.bytes=bytes-bfile->bytes_seen;
+			event.records=records-bfile->records_seen;
+			bfile->bytes_seen=bytes;
+			bfile->records_seen=records;
+			if(copy_to_user((void __user*)arg,&event,sizeof(event)))
+				return -EFAULT;
+			return 0;
+		}
+	case BIGMEM_IOC_DIRTY:
+		{
+			struct bigmem_dirty_req req;
+			unsigned long *bitmap=NULL;
+			size_t len=get_bigmem_dirty_len(mem);
+			unsigned long i=0;
+			long err=0;
+			if(copy_from_user(&req,(void __user*)arg,sizeof(req)))
+				return -EFAULT;
+			if(0==len)
+				return -ENODATA;
+			if(req.len<len)
+				err=-ENOSPC;
+			else if(NULL==(bitmap=(unsigned long*)kvmalloc(len,GFP_KERNEL)))
+				return -ENOMEM;
+			else if((err=fetch_bigmem_dirty(mem,bitmap,len,NULL))==0&&
+					copy_to_user((void __user*)(unsigned long)req.buf,bitmap,len))
+			{
+				/// 复制失败时恢复已取出的位,避免丢失修改
+				for(i=0;i<mem->dirty_words;i++)
+					if(bitmap[i]!=0)
+						atomic_long_or(bitmap[i],&mem->dirty[i]);
+				err=-EFAULT;
+			}
+			kvfree(bitmap);
+			req.len=len;
+			req.shift=mem->dirty_shift;
+			if(copy_to_user((void __user*)arg,&req,sizeof(req)))
+				return -EFAULT;
+			return err;
+		}
+	default:
+		return -ENOTTY;
+	}
+}
+
+static long bigmem_dev_ioctl(struct file *file,unsigned int cmd,unsigned long arg)
+{
+	struct bigmem_file *bfile=(struct bigmem_file*)file->private_data;
+	struct big_mem *mem=NULL;
+	long err=0;
+	int idx=0;
+	if(NULL==(mem=get_dev_mem(bfile->dev,&idx)))
+		err=-ENODEV;
+	else
+		err=_bigmem_dev_ioctl(bfile,mem,cmd,arg);
+	put_dev_mem(idx);
+	return err;
+}
+
+static const struct file_operations bigmem_dev_fops={
+	.owner=THIS_MODULE,
+	.open=bigmem_dev_open,
+	.release=bigmem_dev_release,
+	.mmap=bigmem_dev_mmap,
+	.poll=bigmem_dev_poll,
+	.llseek=bigmem_dev_llseek,
+	.read_iter=bigmem_dev_read_iter,
+	.splice_read=bigmem_dev_splice_read,
+	.unlocked_ioctl=bigmem_dev_ioctl,
+};
+
+/// @brief 注册字符设备/dev/name
+/// @retval 0成功,<0失败
+int register_bigmem_dev(struct big_mem *mem,const char *name)
+{
+	struct bigmem_dev *dev=NULL;
+	unsigned long i=0;
+	int err=0;
+	if(NULL==mem||NULL==name||NULL==mem->addrs)
+		return -EINVAL;
+	if(NULL!=rcu_access_pointer(mem->dev))
+		return -EBUSY;
+	dev=(struct bigmem_dev*)kzalloc(sizeof(struct bigmem_dev),GFP_KERNEL);
+	if(NULL==dev)
+		return -ENOMEM;
+	dev->pages=(struct page**)kvmalloc_array(mem->mem_count,sizeof(struct page*),GFP_KERNEL);
+	if(NULL==dev->pages)
+	{
+		kfree(dev);
+		return -ENOMEM;
+	}
+	for(i=0;i<mem->mem_count;i++)
+		dev->pages[i]=virt_to_page((void*)mem->addrs[i]);
+	dev->page_count=mem->mem_count;
+	kref_init(&dev->ref);
+	strscpy(dev->name,name,sizeof(dev->name));
+	RCU_INIT_POINTER(dev->mem,mem);
+	init_waitqueue_head(&dev->wait);
+	atomic64_set(&dev->bytes,0);
+	atomic64_set(&dev->records,0);
+	dev->misc.minor=MISC_DYNAMIC_MINOR;
+	dev->misc.name=dev->name;
+	dev->misc.fops=&bigmem_dev_fops;
+	dev->misc.mode=0600;
+	if((err=misc_register(&dev->misc))<0)
+	{
+		kref_put(&dev->ref,release_bigmem_dev);
+		return err;
+	}
+	rcu_assign_pointer(mem->dev,dev);
+	return 0;
+}
+EXPORT_SYMBOL(register_bigmem_dev);
+
+/// @brief 注销字符设备
+/// @note 已打开的文件此后返回-ENODEV,poll返回EPOLLHUP;已映射的内存块在解除映射前不会被释放
+void unregister_bigmem_dev(struct big_mem *mem)
+{
+	struct bigmem_dev *dev=NULL;
+	if(NULL==mem||NULL==(dev=rcu_dereference_protected(mem->dev,1)))
+		return;
+	misc_deregister(&dev->misc);
+	RCU_INIT_POINTER(mem->dev,NULL);
+	RCU_INIT_POINTER(dev->mem,NULL);
+	/// 等待正在访问mem或发布数据的读侧结束
+	synchronize_srcu(&bigmem_dev_srcu);
+	wake_up_interruptible_poll(&dev->wait,EPOLLHUP);
+	kref_put(&dev->ref,release_bigmem_dev);
+}
+EXPORT_SYMBOL(unregister_bigmem_dev);
+
+/// @brief 发布新写入的数据,唤醒达到水位的等待者
+void publish_bigmem(struct big_mem *mem,size_t bytes,unsigned long records)
+{
+	struct bigmem_dev *dev=NULL;
+	int idx=0;
+	if(NULL==mem||NULL==rcu_access_pointer(mem->dev))
+		return;
+	idx=srcu_read_lock(&bigmem_dev_srcu);
+	if(NULL!=(dev=srcu_dereference(mem->dev,&bigmem_dev_srcu)))
+	{
+		atomic64_add(bytes,&dev->bytes);
+		atomic64_add(records,&dev->records);
+		if(wq_has_sleeper(&dev->wait))
+			wake_up_interruptible_poll(&dev->wait,EPOLLIN|EPOLLRDNORM);
+	}
+	srcu_read_unlock(&bigmem_dev_srcu,idx);
+}
+EXPORT_SYMBOL(publish_bigmem);
+#endif   /// USER_SPACE
+
+/// @brief 加锁执行一次读取/写入/设置/对比
+/// @note 内核中整个操作在一次加锁内完成,超过BIGMEM_LOCK_NEST个锁分段时独占整个实例
+/// @param[in] op BIGMEM_VEC_READ,BIGMEM_VEC_WRITE,BIGMEM_VEC_SET,BIGMEM_VEC_CMP
+/// @param[in] lock_mode 内核中使用的加锁方式
+static int lock_op_bigmem(struct big_mem *mem,int op,size_t begin,void *buf,size_t len,char data,int *res,size_t *diff,int lock_mode)
+{
+#ifndef USER_SPACE
+	struct bigmem_range range;
+#endif
+	int err=0;
+#ifndef USER_SPACE
+	if((err=lock_bigmem(mem,begin,len,lock_mode,&range))<0)
+		return err;
+#else    /// USER_SPACE
+	(void)lock_mode;
+#endif   /// USER_SPACE
+	switch(op)
+	{
+	case BIGMEM_VEC_WRITE:
+		err=_write_bigmem(mem,begin,buf,len);
+		break;
+	case BIGMEM_VEC_SET:
+		err=_set_bigmem(mem,begin,len,data);
+		break;
+	case BIGMEM_VEC_CMP:
+		err=_cmp_bigmem(mem,begin,buf,len,res,diff);
+		break;
+	default:
+		err=_read_bigmem(mem,begin,buf,len);
+		break;
+	}
+#ifndef USER_SPACE
+	unlock_bigmem(mem,&range,lock_mode);
+#endif
+	if(0==err)
+		account_bigmem_op(mem,op,begin,len);
+	return err;
+}
+
+
+/// @brief 把缓冲区数据写入内存
+/// @param[in] begin,写入到mem的位置
+/// @param[in] buf,缓冲区首地址
+/// @param[in] size, 缓冲区大小
+/// @retval 0成功, <0失败
+int write_bigmem(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size)
+{
+	int err=0;
+	if(NULL==mem)
+		return -EINVAL;
+	err=lock_op_bigmem(mem,BIGMEM_VEC_WRITE,begin,(void*)buf,buf_size,0,NULL,NULL,BIGMEM_LOCK_WRITE);
+#ifndef USER_SPACE
+	if(0==err&&NULL!=rcu_access_pointer(mem->dev))
+		publish_bigmem(mem,buf_size,1);
+#endif
+	return err;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(write_bigmem);
+#endif
+
+/// @brief 读取数据到缓冲区
+/// @param[in] begin,读取数据的mem的位置
+/// @param[in] buf,缓冲区首地址
+/// @param[in] size, 缓冲区大小
+/// @retval 0成功, <0失败
+int read_bigmem(struct big_mem *mem,size_t begin,void *buf,size_t buf_size)
+{
+	if(NULL==mem)
+		return -EINVAL;
+	return lock_op_bigmem(mem,BIGMEM_VEC_READ,begin,buf,buf_size,0,NULL,NULL,0);
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(read_bigmem);
+#endif
+
+
+/// @brief 设置内存数据为data
+/// @param[in] begin,len设置内存的范围(起始，长度)
+/// @param[in] data,设置为的值
+/// @retval 0成功, <0失败
+int set_bigmem(struct big_mem *mem,size_t begin,size_t len,char data)
+{
+	if(NULL==mem)
+		return -EINVAL;
+	return lock_op_bigmem(mem,BIGMEM_VEC_SET,begin,NULL,len,data,NULL,NULL,BIGMEM_LOCK_WRITE);
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(set_bigmem);
+#endif
+
+
+/// @brief 返回内存数据的长度
+size_t get_bigmem_len(const struct big_mem *mem)
+{
+	if(NULL==mem)
+		return 0;
+	return mem->mem_size;
+}
+
+#ifndef USER_SPACE
+EXPORT_SYMBOL(get_bigmem_len);
+#endif
+
+/// @brief 返回内存位置begin所在内存块的NUMA节点
+/// @retval 节点号,未知或越界时返回-1
+int get_bigmem_node(struct big_mem *mem,size_t begin)
+{
+	unsigned long block_index=0;
+	if(NULL==mem||NULL==mem->nodes)
+		return -1;
+	if(cal_bigmem_coord(mem,begin,&block_index,NULL)<0)
+		return -1;
+	return mem->nodes[block_index];
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(get_bigmem_node);
+#endif
+
+/// @brief 设置流式写入的阈值,单次写入或设置不小于threshold字节时绕过CPU缓存
+/// @param[in] threshold 0表示关闭流式写入
+void set_bigmem_stream_threshold(struct big_mem *mem,size_t threshold)
+{
+	if(NULL==mem)
+		return;
+#ifndef USER_SPACE
+	WRITE_ONCE(mem->stream_threshold,threshold);
+#else    /// USER_SPACE
+	mem->stream_threshold=threshold;
+#endif   /// USER_SPACE
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(set_bigmem_stream_threshold);
+#endif
+
+/// @brief 返回内存位置begin在连续映射中的指针
+/// @retval 未建立连续映射或越界时返回NULL
+void *get_bigmem_ptr(struct big_mem *mem,size_t begin)
+{
+	if(NULL==mem||NULL==mem->base)
+		return NULL;
+	if(begin>=mem->mem_size)
+		return NULL;
+	return (char*)mem->base+begin;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(get_bigmem_ptr);
+#endif
+
+/// @breif 对比缓冲区和内存结构中的数据
+/// @param[in] begin,对比数据的首地址
+/// @param[in] buf,缓冲区首地址
+/// @param[in] size, 缓冲区大小
+/// @param[out] res memcmp的返回值
+/// @retval 0成功 <0失败
+int cmp_bigmem(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res)
+{
+	if(NULL==mem||NULL==res)
+		return -EINVAL;
+	return lock_op_bigmem(mem,BIGMEM_VEC_CMP,begin,(void*)buf,buf_size,0,res,NULL,0);
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(cmp_bigmem);
+#endif
+
+/// @breif 对比缓冲区和内存结构中的数据,并返回第一个不相等字节的位置
+/// @param[out] res memcmp的返回值
+/// @param[out] diff 第一个不相等字节在mem中的位置,全部相等时为begin+buf_size
+/// @retval 0成功 <0失败
+int cmp_bigmem_diff(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res,size_t *diff)
+{
+	if(NULL==mem||NULL==res||NULL==diff)
+		return -EINVAL;
+	return lock_op_bigmem(mem,BIGMEM_VEC_CMP,begin,(void*)buf,buf_size,0,res,diff,0);
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(cmp_bigmem_diff);
+#endif
+
+#ifndef USER_SPACE
+/// @brief 把缓冲区数据写入内存,使用bh锁
+int write_bigmem_bh(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size)
+{
+	int err=0;
+	if(NULL==mem)
+		return -EINVAL;
+	err=lock_op_bigmem(mem,BIGMEM_VEC_WRITE,begin,(void*)buf,buf_size,0,NULL,NULL,BIGMEM_LOCK_WRITE|BIGMEM_LOCK_BH);
+	if(0==err&&NULL!=rcu_access_pointer(mem->dev))
+		publish_bigmem(mem,buf_size,1);
+	return err;
+}
+EXPORT_SYMBOL(write_bigmem_bh);
+/// @brief 读取数据到缓冲区 使用bh锁
+int read_bigmem_bh(struct big_mem *mem,size_t begin,void *buf,size_t buf_size)
+{
+	if(NULL==mem)
+		return -EINVAL;
+	return lock_op_bigmem(mem,BIGMEM_VEC_READ,begin,buf,buf_size,0,NULL,NULL,BIGMEM_LOCK_BH);
+}
+EXPORT_SYMBOL(read_bigmem_bh);
+/// @brief 设置内存数据为data
+int set_bigmem_bh(struct big_mem *mem,size_t begin,size_t len,char data)
+{
+	if(NULL==mem)
+		return -EINVAL;
+	return lock_op_bigmem(mem,BIGMEM_VEC_SET,begin,NULL,len,data,NULL,NULL,BIGMEM_LOCK_WRITE|BIGMEM_LOCK_BH);
+}
+EXPORT_SYMBOL(set_bigmem_bh);
+
+/// @breif 对比缓冲区和内存结构中的数据
+/// @param[out] res memcmp的返回值
+/// @retval 0成功 <0失败
+int cmp_bigmem_bh(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res)
+{
+	if(NULL==mem||NULL==res)
+		return -EINVAL;
+	return lock_op_bigmem(mem,BIGMEM_VEC_CMP,begin,(void*)buf,buf_size,0,res,NULL,BIGMEM_LOCK_BH);
+}
+EXPORT_SYMBOL(cmp_bigmem_bh);
+
+/// @brief 读取数据到缓冲区,不加锁,读取期间有写入时重试
+int read_bigmem_seq(struct big_mem *mem,size_t begin,void *buf,size_t buf_size)
+{
+	struct bigmem_range range;
+	unsigned int seq;
+	int err=0;
+	if(NULL==mem)
+		return -EINVAL;
+	if((err=cal_bigmem_range(mem,begin,buf_size,&range))<0)
+	{
+		stat_bigmem_error(mem);
+		return err;
+	}
+	do
+	{
+		seq=read_bigmem_seq_begin(mem,&range);
+		err=_read_bigmem(mem,begin,buf,buf_size);
+	}
+	while(read_bigmem_seq_retry(mem,&range,seq));
+	if(0==err)
+		account_bigmem_op(mem,BIGMEM_STAT_READ,begin,buf_size);
+	return err;
+}
+EXPORT_SYMBOL(read_bigmem_seq);
+
+/// @breif 对比缓冲区和内存结构中的数据,不加锁,对比期间有写入时重试
+int cmp_bigmem_seq(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res)
+{
+	struct bigmem_range range;
+	unsigned int seq;
+	int err=0;
+	if(NULL==mem)
+		return -EINVAL;
+	if((err=cal_bigmem_range(mem,begin,buf_size,&range))<0)
+	{
+		stat_bigmem_error(mem);
+		return err;
+	}
+	do
+	{
+		seq=read_bigmem_seq_begin(mem,&range);
+		err=_cmp_bigmem(mem,begin,buf,buf_size,res,NULL);
+	}
+	while(read_bigmem_seq_retry(mem,&range,seq));
+	if(0==err)
+		account_bigmem_op(mem,BIGMEM_STAT_CMP,begin,buf_size);
+	return err;
+}
+EXPORT_SYMBOL(cmp_bigmem_seq);
+#endif   ///USER_SPACE
+
+/// @brief 在n字节内查找字节c
+/// @note 用户态使用libc的memchr(SSE2/AVX2实现);内核中按字并行比较,不使用FPU
+static inline const unsigned char *scan_byte(const unsigned char *p,unsigned char c,size_t n)
+{
+#ifndef USER_SPACE
+	const unsigned long ones=REPEAT_BYTE(0x01);
+	const unsigned long highs=REPEAT_BYTE(0x80);
+	const unsigned long mask=REPEAT_BYTE(c);
+	/// 逐字节对齐到字边界
+	while(n>0&&((unsigned long)p&(sizeof(unsigned long)-1)))
+	{
+		if(*p==c)
+			return p;
+		p++;
+		n--;
+	}
+	/// 按字比较,字中含有c时退出
+	while(n>=sizeof(unsigned long))
+	{
+		unsigned long word=*(const unsigned long*)p^mask;
+		if(((word-ones)&~word&highs)!=0)
+			break;
+		p+=sizeof(unsigned long);
+		n-=sizeof(unsigned long);
+	}
+	while(n>0)
+	{
+		if(*p==c)
+			return p;
+		p++;
+		n--;
+	}
+	return NULL;
+#else    /// USER_SPACE
+	return (const unsigned char*)memchr(p,c,n);
+#endif   /// USER_SPACE
+}
+
+/// @brief 查找状态,跨越内存块和加锁批次保持
+struct find_state
+{
+	const unsigned char *pattern;
+	size_t len;
+	size_t *fail;     ///< KMP失配表,fail[i]为pattern[0..i]最长的真前缀后缀长度,len为1时为NULL
+	size_t matched;   ///< 已匹配的长度
+};
+
+/// @brief 建立KMP失配表
+static void init_find_fail(const unsigned char *pattern,size_t len,size_t *fail)
+{
+	size_t k=0;
+	size_t i=0;
+	fail[0]=0;
+	for(i=1;i<len;i++)
+	{
+		while(k>0&&pattern[i]!=pattern[k])
+			k=fail[k-1];
+		if(pattern[i]==pattern[k])
+			k++;
+		fail[i]=k;
+	}
+}
+
+/// @brief 在[begin,begin+len)内继续查找,state->matched为之前已匹配的长度,可跨越内存块边界
+/// @note 每个字节只读取一次,失配回退的总次数不超过匹配前进的次数,时间与len成线性;
+/// 没有部分匹配时用scan_byte跳到下一个首字节
+/// @retval 0找到 -ENOENT未找到
+static int _find_bigmem(struct big_mem *mem,size_t begin,size_t len,struct find_state *state,size_t *pos)
+{
+	const unsigned char *pattern=state->pattern;
+	size_t matched=state->matched;
+	unsigned long block_index=0;
+	size_t inner_index=0;
+	size_t cur=begin;
+	const size_t end=begin+len;
+	if(0==len)
+		return -ENOENT;
+	cal_bigmem_coord(mem,begin,&block_index,&inner_index);
+	while(cur<end)
+	{
+		const unsigned char *base=(const unsigned char*)(mem->addrs[block_index]+inner_index);
+		size_t seg=mem->sizes[block_index]-inner_index;
+		size_t i=0;
+		if(seg>end-cur)
+			seg=end-cur;
+		while(i<seg)
+		{
+			if(0==matched)
+			{
+				const unsigned char *hit=scan_byte(base+i,pattern[0],seg-i);
+				if(NULL==hit)
+					break;
+				i=hit-base;
+			}
+			while(matched>0&&base[i]!=pattern[matched])
+				matched=state->fail[matched-1];
+			if(base[i]==pattern[matched])
+				matched++;
+			i++;
+			if(matched==state->len)
+			{
+				*pos=cur+i-matched;
+				return 0;
+			}
+		}
+		cur+=seg;
+		block_index++;
+		inner_index=0;
+	}
+	state->matched=matched;
+	return -ENOENT;
+}
+
+/// @brief 在[begin,begin+len)内查找pattern第一次出现的位置
+/// @note 内核中分批加锁查找,匹配状态在批次之间保持;pattern_len大于1时分配失配表,可能睡眠
+/// @param[out] pos 找到的位置
+/// @retval 0找到 -ENOENT未找到 其他<0失败
+int find_bigmem(struct big_mem *mem,size_t begin,size_t len,const void *pattern,size_t pattern_len,size_t *pos)
+{
+	struct find_state state={.pattern=(const unsigned char*)pattern,.len=pattern_len,.fail=NULL,.matched=0};
+#ifndef USER_SPACE
+	struct bigmem_range range;
+	size_t cur=begin;
 #endif
+	int err=0;
+	if(NULL==mem||NULL==pattern||0==pattern_len||NULL==pos)
+		return -EINVAL;
+	if(0==len)
+		return -ENOENT;
+	if((err=check_bigmem_range(mem,begin,len))<0)
+		return err;
+	if(len<pattern_len)
+		return -ENOENT;
+	if(pattern_len>1)
+	{
+		if(NULL==(state.fail=(size_t*)bigmem_malloc(sizeof(size_t)*pattern_len)))
+			return -ENOMEM;
+		init_find_fail(state.pattern,pattern_len,state.fail);
+	}
+#ifndef USER_SPACE
+	while(1)
+	{
+		if((err=lock_bigmem(mem,cur,begin+len-cur,BIGMEM_LOCK_BATCH,&range))<0)
+			break;
+		err=_find_bigmem(mem,cur,range.len,&state,pos);
+		unlock_bigmem(mem,&range,BIGMEM_LOCK_BATCH);
+		if(err!=-ENOENT||cur+range.len==begin+len)
+			break;
+		/// 批次之间释放锁,跨越批边界的匹配由保持的状态继续
+		cur+=range.len;
+	}
+#else    /// USER_SPACE
+	err=_find_bigmem(mem,begin,len,&state,pos);
+#endif   /// USER_SPACE
+	bigmem_free(state.fail);
 	return err;
 }
 #ifndef USER_SPACE
-EXPORT_SYMBOL(read_bigmem);
+EXPORT_SYMBOL(find_bigmem);
+#endif
+
+/// @brief 在[begin,begin+len)内查找字节data第一次出现的位置
+/// @param[out] pos 找到的位置
+/// @retval 0找到 -ENOENT未找到 其他<0失败
+int memchr_bigmem(struct big_mem *mem,size_t begin,size_t len,char data,size_t *pos)
+{
+	return find_bigmem(mem,begin,len,&data,1,pos);
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(memchr_bigmem);
+#endif
+
+#ifdef USER_SPACE
+/// CRC32C(多项式0x82F63B78,反射)的4位查找表
+static const __u32 crc32c_nibble[16]=
+{
+	0x00000000,0x105ec76f,0x20bd8ede,0x30e349b1,0x417b1dbc,0x5125dad3,0x61c69362,0x7198540d,
+	0x82f63b78,0x92a8fc17,0xa24bb5a6,0xb21572c9,0xc38d26c4,0xd3d3e1ab,0xe330a81a,0xf36e6f75
+};
+
+/// @brief 查表计算CRC32C,用于不支持crc32指令的CPU
+static __u32 crc32c_soft(__u32 crc,const unsigned char *p,size_t len)
+{
+	while(len-->0)
+	{
+		crc^=*p++;
+		crc=(crc>>4)^crc32c_nibble[crc&0xf];
+		crc=(crc>>4)^crc32c_nibble[crc&0xf];
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+/// @brief 使用SSE4.2的crc32指令计算CRC32C,每次处理8字节
+__attribute__((target("sse4.2")))
+static __u32 crc32c_sse42(__u32 crc,const unsigned char *p,size_t len)
+{
+	unsigned long long crc64=0;
+	while(len>0&&((unsigned long)p&7))
+	{
+		crc=_mm_crc32_u8(crc,*p++);
+		len--;
+	}
+	crc64=crc;
+	while(len>=8)
+	{
+		crc64=_mm_crc32_u64(crc64,*(const unsigned long long*)p);
+		p+=8;
+		len-=8;
+	}
+	crc=(__u32)crc64;
+	while(len-->0)
+		crc=_mm_crc32_u8(crc,*p++);
+	return crc;
+}
+#endif
+#endif   /// USER_SPACE
+
+/// @brief 累计计算CRC32C,crc为未取反的中间值
+/// @note 内核使用crc32c库(按CPU选择硬件实现);用户态在支持SSE4.2时使用crc32指令
+static inline __u32 crc32c_update(__u32 crc,const void *p,size_t len)
+{
+#ifndef USER_SPACE
+	return crc32c(crc,p,len);
+#else    /// USER_SPACE
+#if defined(__x86_64__)
+	if(__builtin_cpu_supports("sse4.2"))
+		return crc32c_sse42(crc,(const unsigned char*)p,len);
+#endif
+	return crc32c_soft(crc,(const unsigned char*)p,len);
+#endif   /// USER_SPACE
+}
+
+/// @brief 从内存坐标(block_index,inner_index)开始,逐块累计计算CRC32C
+static __u32 crc_blocks(struct big_mem *mem,unsigned long block_index,size_t inner_index,size_t len,__u32 crc)
+{
+	while(len>0)
+	{
+		size_t seg=mem->sizes[block_index]-inner_index;
+		if(seg>len)
+			seg=len;
+		crc=crc32c_update(crc,(void*)(mem->addrs[block_index]+inner_index),seg);
+		len-=seg;
+		block_index++;
+		inner_index=0;
+	}
+	return crc;
+}
+
+/// @brief 计算[begin,begin+len)的CRC32C,可分段累计计算
+/// @param[in,out] crc 传入之前各段的结果(首段为0),返回累计到本段的结果
+/// @retval 0成功 <0失败
+int crc32c_bigmem(struct big_mem *mem,size_t begin,size_t len,__u32 *crc)
+{
+#ifndef USER_SPACE
+	struct bigmem_range range;
+	size_t done=0;
+#endif
+	unsigned long block_index=0;
+	size_t inner_index=0;
+	int err=0;
+	if(NULL==mem||NULL==crc)
+		return -EINVAL;
+	if(0==len)
+		return 0;
+#ifndef USER_SPACE
+	/// 分批加锁,CRC跨批累计
+	while(done<len)
+	{
+		if((err=lock_bigmem(mem,begin+done,len-done,BIGMEM_LOCK_BATCH,&range))<0)
+			return err;
+		cal_bigmem_coord(mem,begin+done,&block_index,&inner_index);
+		*crc=~crc_blocks(mem,block_index,inner_index,range.len,~*crc);
+		unlock_bigmem(mem,&range,BIGMEM_LOCK_BATCH);
+		done+=range.len;
+	}
+#else    /// USER_SPACE
+	if((err=check_bigmem_range(mem,begin,len))<0)
+		return err;
+	cal_bigmem_coord(mem,begin,&block_index,&inner_index);
+	*crc=~crc_blocks(mem,block_index,inner_index,len,~*crc);
+#endif   /// USER_SPACE
+	return 0;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(crc32c_bigmem);
+#endif
+
+/// @brief 内存块的CRC32C缓存是否有效,有效时其后读取的缓存值不早于有效位
+static inline int test_block_crc(struct big_mem *mem,unsigned long block_index)
+{
+#ifndef USER_SPACE
+	if(!test_bit(block_index,mem->crc_valid))
+		return 0;
+	smp_rmb();
+	return 1;
+#else    /// USER_SPACE
+	return (__atomic_load_n(&mem->crc_valid[block_index/BIGMEM_LONG_BITS],__ATOMIC_ACQUIRE)>>(block_index%BIGMEM_LONG_BITS))&1;
+#endif   /// USER_SPACE
+}
+
+/// @brief 缓存值写入后设置有效位
+static inline void set_block_crc(struct big_mem *mem,unsigned long block_index)
+{
+#ifndef USER_SPACE
+	smp_mb__before_atomic();
+	set_bit(block_index,mem->crc_valid);
+#else    /// USER_SPACE
+	__atomic_fetch_or(&mem->crc_valid[block_index/BIGMEM_LONG_BITS],1UL<<(block_index%BIGMEM_LONG_BITS),__ATOMIC_RELEASE);
+#endif   /// USER_SPACE
+}
+
+/// @brief 启用各内存块CRC32C缓存,须在并发访问开始前调用
+/// @retval 0成功 <0失败
+int enable_bigmem_crc(struct big_mem *mem)
+{
+	size_t valid_size=0;
+	if(NULL==mem||NULL==mem->addrs||NULL==mem->sizes)
+		return -EINVAL;
+	if(NULL!=mem->crc_valid)
+		return 0;
+	valid_size=(mem->mem_count+BIGMEM_LONG_BITS-1)/BIGMEM_LONG_BITS*sizeof(unsigned long);
+	mem->block_crcs=(__u32*)bigmem_malloc(sizeof(__u32)*mem->mem_count);
+	mem->crc_valid=(unsigned long*)bigmem_malloc(valid_size);
+	if(NULL==mem->block_crcs||NULL==mem->crc_valid)
+	{
+		disable_bigmem_crc(mem);
+		return -ENOMEM;
+	}
+	memset(mem->crc_valid,0,valid_size);
+	return 0;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(enable_bigmem_crc);
+#endif
+
+/// @brief 停用并释放CRC32C缓存
+void disable_bigmem_crc(struct big_mem *mem)
+{
+	if(NULL==mem)
+		return;
+	bigmem_free(mem->crc_valid);
+	bigmem_free(mem->block_crcs);
+	mem->crc_valid=NULL;
+	mem->block_crcs=NULL;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(disable_bigmem_crc);
+#endif
+
+/// @brief 获取内存块block_index的CRC32C,缓存有效时不重新计算
+/// @retval 0成功 <0失败
+int get_bigmem_block_crc(struct big_mem *mem,unsigned long block_index,__u32 *crc)
+{
+#ifndef USER_SPACE
+	struct bigmem_range range;
+	int err=0;
+#endif
+	if(NULL==mem||NULL==crc||NULL==mem->offsets||block_index>=mem->mem_count)
+		return -EINVAL;
+#ifndef USER_SPACE
+	/// 读锁保证计算期间没有写入,并发的读者写入相同的缓存值
+	if((err=lock_bigmem(mem,mem->offsets[block_index],mem->sizes[block_index],0,&range))<0)
+		return err;
+#endif
+	if(NULL!=mem->crc_valid&&test_block_crc(mem,block_index))
+		*crc=mem->block_crcs[block_index];
+	else
+	{
+		*crc=~crc32c_update(~0U,(void*)mem->addrs[block_index],mem->sizes[block_index]);
+		if(NULL!=mem->crc_valid)
+		{
+			mem->block_crcs[block_index]=*crc;
+			set_block_crc(mem,block_index);
+		}
+	}
+#ifndef USER_SPACE
+	unlock_bigmem(mem,&range,0);
+#endif
+	return 0;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(get_bigmem_block_crc);
+#endif
+
+/// @brief 使与[begin,begin+len)相交的内存块的CRC32C缓存失效
+/// @note 内核中加写锁,等待正在计算的读者完成后再清除
+void invalidate_bigmem_crc(struct big_mem *mem,size_t begin,size_t len)
+{
+#ifndef USER_SPACE
+	struct bigmem_range range;
+	size_t done=0;
+#endif
+	unsigned long first=0;
+	unsigned long last=0;
+	size_t inner_index=0;
+	if(NULL==mem||NULL==mem->crc_valid||0==len)
+		return;
+#ifndef USER_SPACE
+	/// 分批加写锁,等待正在计算的读者
+	while(done<len)
+	{
+		if(lock_bigmem(mem,begin+done,len-done,BIGMEM_LOCK_WRITE|BIGMEM_LOCK_BATCH,&range)<0)
+			return;
+		cal_bigmem_coord(mem,begin+done,&first,&inner_index);
+		cal_bigmem_coord(mem,begin+done+range.len-1,&last,&inner_index);
+		for(;first<=last;first++)
+			clear_block_crc(mem,first);
+		unlock_bigmem(mem,&range,BIGMEM_LOCK_WRITE|BIGMEM_LOCK_BATCH);
+		done+=range.len;
+	}
+#else    /// USER_SPACE
+	if(check_bigmem_range(mem,begin,len)<0)
+		return;
+	cal_bigmem_coord(mem,begin,&first,&inner_index);
+	cal_bigmem_coord(mem,begin+len-1,&last,&inner_index);
+	for(;first<=last;first++)
+		clear_block_crc(mem,first);
+#endif   /// USER_SPACE
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(invalidate_bigmem_crc);
+#endif
+
+/// @brief 启用脏数据跟踪,写入和设置操作标记所在的2^shift字节区间
+/// @note 须在并发访问开始前调用
+/// @retval 0成功 -EBUSY已使用其他粒度启用 其他<0失败
+int enable_bigmem_dirty(struct big_mem *mem,unsigned int shift)
+{
+	unsigned long units=0;
+	if(NULL==mem||0==mem->mem_size||shift>=sizeof(size_t)*8)
+		return -EINVAL;
+	if(NULL!=mem->dirty)
+		return mem->dirty_shift==shift?0:-EBUSY;
+	units=((mem->mem_size-1)>>shift)+1;
+	mem->dirty_words=(units+BIGMEM_LONG_BITS-1)/BIGMEM_LONG_BITS;
+	mem->dirty=bigmem_malloc(sizeof(*mem->dirty)*mem->dirty_words);
+	if(NULL==mem->dirty)
+	{
+		mem->dirty_words=0;
+		return -ENOMEM;
+	}
+	memset(mem->dirty,0,sizeof(*mem->dirty)*mem->dirty_words);
+	mem->dirty_shift=shift;
+	return 0;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(enable_bigmem_dirty);
+#endif
+
+/// @brief 停用脏数据跟踪并释放位图
+void disable_bigmem_dirty(struct big_mem *mem)
+{
+	if(NULL==mem)
+		return;
+	bigmem_free(mem->dirty);
+	mem->dirty=NULL;
+	mem->dirty_words=0;
+	mem->dirty_shift=0;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(disable_bigmem_dirty);
+#endif
+
+/// @brief 返回脏位图的字节数,未启用时返回0
+size_t get_bigmem_dirty_len(const struct big_mem *mem)
+{
+	if(NULL==mem||NULL==mem->dirty)
+		return 0;
+	return mem->dirty_words*sizeof(unsigned long);
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(get_bigmem_dirty_len);
+#endif
+
+/// @brief 获取并清除脏位图,每个字原子地交换为0
+/// @param[out] count 脏区间数量,可以为NULL
+/// @retval 0成功 -ENOSPC缓冲区不足 -ENODATA未启用 其他<0失败
+int fetch_bigmem_dirty(struct big_mem *mem,unsigned long *bitmap,size_t len,size_t *count)
+{
+	size_t dirty_count=0;
+	unsigned long i=0;
+	if(NULL==mem||NULL==bitmap)
+		return -EINVAL;
+	if(NULL==mem->dirty)
+		return -ENODATA;
+	if(len<get_bigmem_dirty_len(mem))
+		return -ENOSPC;
+	for(i=0;i<mem->dirty_words;i++)
+	{
+		unsigned long word=0;
+		/// 跳过全0的字,避免无谓地独占缓存行
+#ifndef USER_SPACE
+		if(atomic_long_read(&mem->dirty[i])!=0)
+			word=atomic_long_xchg(&mem->dirty[i],0);
+		dirty_count+=hweight_long(word);
+#else    /// USER_SPACE
+		if(__atomic_load_n(&mem->dirty[i],__ATOMIC_RELAXED)!=0)
+			word=__atomic_exchange_n(&mem->dirty[i],0,__ATOMIC_SEQ_CST);
+		dirty_count+=__builtin_popcountl(word);
+#endif   /// USER_SPACE
+		bitmap[i]=word;
+	}
+	if(NULL!=count)
+		*count=dirty_count;
+	return 0;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(fetch_bigmem_dirty);
+#endif
+
+#ifndef USER_SPACE
+/// @brief 把锁分段[first,last]并入升序集合set
+/// @retval 0成功 -E2BIG合并后超过BIGMEM_LOCK_NEST个分段(set不变)
+static int merge_stripe_set(unsigned long *set,unsigned int *count,unsigned long first,unsigned long last)
+{
+	unsigned long merged[BIGMEM_LOCK_NEST];
+	unsigned int n=0;
+	unsigned int i=0;
+	unsigned long next=first;   ///< [first,last]中下一个待并入的分段
+	while(i<*count||next<=last)
+	{
+		unsigned long stripe=0;
+		if(next>last||(i<*count&&set[i]<next))
+			stripe=set[i++];
+		else
+		{
+			stripe=next++;
+			if(i<*count&&set[i]==stripe)
+				i++;
+		}
+		if(n==BIGMEM_LOCK_NEST)
+			return -E2BIG;
+		merged[n++]=stripe;
+	}
+	memcpy(set,merged,sizeof(unsigned long)*n);
+	*count=n;
+	return 0;
+}
+
+#endif   /// USER_SPACE
+
+/// @brief 检查批量操作并加锁执行
+/// @note 内核中所有项在一次加锁内完成,按升序锁住各项涉及的锁分段,
+/// 合计超过BIGMEM_LOCK_NEST个分段时独占整个实例
+/// @param[in] lock_mode 内核中使用的加锁方式
+static int lock_vec_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count,int op,char data,int *res,int lock_mode)
+{
+#ifndef USER_SPACE
+	unsigned long set[BIGMEM_LOCK_NEST];   ///< 各项涉及的锁分段
+	struct bigmem_range range;
+	int i=0;
+#endif
+	size_t len=0;
+	int err=0;
+	if(BIGMEM_VEC_CMP==op&&NULL==res)
+		return -EINVAL;
+	if((err=check_bigmem_vec(mem,vec,count,&len))<0)
+		return err;
+	if(NULL!=res)
+		*res=0;
+	if(0==len)
+		return 0;
+#ifndef USER_SPACE
+	range.first=1;
+	range.last=0;
+	range.set=set;
+	range.count=0;
+	for(i=0;i<count;i++)
+	{
+		struct bigmem_range item;
+		if(0==vec[i].len)
+			continue;
+		cal_bigmem_range(mem,vec[i].begin,vec[i].len,&item);
+		if(item.last-item.first>=BIGMEM_LOCK_NEST||merge_stripe_set(set,&range.count,item.first,item.last)<0)
+			break;
+	}
+	range.whole=i<count;
+	lock_bigmem_stripes(mem,&range,lock_mode);
+	_vec_bigmem(mem,vec,count,op,data,res);
+	unlock_bigmem(mem,&range,lock_mode);
+	if(BIGMEM_VEC_WRITE==op&&NULL!=rcu_access_pointer(mem->dev))
+		publish_bigmem(mem,len,1);
+#else    /// USER_SPACE
+	(void)lock_mode;
+	_vec_bigmem(mem,vec,count,op,data,res);
+#endif   /// USER_SPACE
+	return 0;
+}
+
+/// @brief 批量写入,内核中所有项在一次加锁内完成
+/// @retval 0成功, <0失败(任一项越界时不写入任何数据)
+int writev_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count)
+{
+	return lock_vec_bigmem(mem,vec,count,BIGMEM_VEC_WRITE,0,NULL,BIGMEM_LOCK_WRITE);
+}
+
+/// @brief 批量读取,内核中所有项在一次加锁内完成
+/// @retval 0成功, <0失败
+int readv_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count)
+{
+	return lock_vec_bigmem(mem,vec,count,BIGMEM_VEC_READ,0,NULL,0);
+}
+
+/// @brief 批量设置内存数据为data,忽略各项的buf
+/// @retval 0成功, <0失败
+int setv_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count,char data)
+{
+	return lock_vec_bigmem(mem,vec,count,BIGMEM_VEC_SET,data,NULL,BIGMEM_LOCK_WRITE);
+}
+
+/// @brief 批量对比,遇到第一个不相等的项时停止
+/// @param[out] res 第一个不相等项的memcmp结果,全部相等时为0
+/// @retval 0成功, <0失败
+int cmpv_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count,int *res)
+{
+	return lock_vec_bigmem(mem,vec,count,BIGMEM_VEC_CMP,0,res,0);
+}
+
+#ifndef USER_SPACE
+EXPORT_SYMBOL(writev_bigmem);
+EXPORT_SYMBOL(readv_bigmem);
+EXPORT_SYMBOL(setv_bigmem);
+EXPORT_SYMBOL(cmpv_bigmem);
+
+/// @brief 批量写入,使用bh锁
+int writev_bigmem_bh(struct big_mem *mem,const struct bigmem_vec *vec,int count)
+{
+	return lock_vec_bigmem(mem,vec,count,BIGMEM_VEC_WRITE,0,NULL,BIGMEM_LOCK_WRITE|BIGMEM_LOCK_BH);
+}
+EXPORT_SYMBOL(writev_bigmem_bh);
+
+/// @brief 批量读取,使用bh锁
+int readv_bigmem_bh(struct big_mem *mem,const struct bigmem_vec *vec,int count)
+{
+	return lock_vec_bigmem(mem,vec,count,BIGMEM_VEC_READ,0,NULL,BIGMEM_LOCK_BH);
+}
+EXPORT_SYMBOL(readv_bigmem_bh);
+
+/// @brief 批量设置内存数据,使用bh锁
+int setv_bigmem_bh(struct big_mem *mem,const struct bigmem_vec *vec,int count,char data)
+{
+	return lock_vec_bigmem(mem,vec,count,BIGMEM_VEC_SET,data,NULL,BIGMEM_LOCK_WRITE|BIGMEM_LOCK_BH);
+}
+EXPORT_SYMBOL(setv_bigmem_bh);
+
+/// @brief 批量对比,使用bh锁
+int cmpv_bigmem_bh(struct big_mem *mem,const struct bigmem_vec *vec,int count,int *res)
+{
+	return lock_vec_bigmem(mem,vec,count,BIGMEM_VEC_CMP,0,res,BIGMEM_LOCK_BH);
+}
+EXPORT_SYMBOL(cmpv_bigmem_bh);
+#endif   /// USER_SPACE
+
+#ifndef USER_SPACE
+#define ring_load_acquire(ptr) smp_load_acquire(ptr)
+#define ring_store_release(ptr,value) smp_store_release(ptr,value)
+#define ring_relax() cpu_relax()
+
+/// @brief 位置仍为old时更新为value
+static inline int ring_cmpxchg(__u64 *ptr,__u64 old,__u64 value)
+{
+	return cmpxchg64(ptr,old,value)==old;
+}
+#else    /// USER_SPACE
+#define ring_load_acquire(ptr) __atomic_load_n(ptr,__ATOMIC_ACQUIRE)
+#define ring_store_release(ptr,value) __atomic_store_n(ptr,value,__ATOMIC_RELEASE)
+/// 之前的生产者可能在其他进程中被调度出去,让出CPU
+#define ring_relax() sched_yield()
+
+static inline int ring_cmpxchg(__u64 *ptr,__u64 old,__u64 value)
+{
+	return __atomic_compare_exchange_n(ptr,&old,value,0,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED);
+}
+#endif   /// USER_SPACE
+
+/// @brief 记录头部长度字段的大小
+#define RING_RECORD_HEAD sizeof(__u32)
+
+/// @brief 计算长度为len的记录占用的空间
+static inline __u64 ring_record_size(size_t len)
+{
+	return (RING_RECORD_HEAD+len+BIGMEM_RING_ALIGN-1)&~(__u64)(BIGMEM_RING_ALIGN-1);
+}
+
+/// @brief 从环形位置pos写入数据,在数据区末尾回绕
+static void ring_copy_in(struct bigmem_ring *ring,__u64 pos,const void *buf,size_t len)
+{
+	size_t offset=pos%ring->capacity;
+	size_t first=ring->capacity-offset;
+	if(first>len)
+		first=len;
+	lock_op_bigmem(ring->mem,BIGMEM_VEC_WRITE,BIGMEM_RING_HEAD_SIZE+offset,(void*)buf,first,0,NULL,NULL,BIGMEM_LOCK_WRITE);
+	if(len>first)
+		lock_op_bigmem(ring->mem,BIGMEM_VEC_WRITE,BIGMEM_RING_HEAD_SIZE,(char*)buf+first,len-first,0,NULL,NULL,BIGMEM_LOCK_WRITE);
+}
+
+/// @brief 从环形位置pos读取数据,在数据区末尾回绕
+static void ring_copy_out(struct bigmem_ring *ring,__u64 pos,void *buf,size_t len)
+{
+	size_t offset=pos%ring->capacity;
+	size_t first=ring->capacity-offset;
+	if(first>len)
+		first=len;
+	lock_op_bigmem(ring->mem,BIGMEM_VEC_READ,BIGMEM_RING_HEAD_SIZE+offset,buf,first,0,NULL,NULL,0);
+	if(len>first)
+		lock_op_bigmem(ring->mem,BIGMEM_VEC_READ,BIGMEM_RING_HEAD_SIZE,(char*)buf+first,len-first,0,NULL,NULL,0);
+}
+
+/// @brief 环形位置pos开始,在同一内存块中且不回绕的连续字节数
+static size_t ring_contig(struct bigmem_ring *ring,__u64 pos)
+{
+	size_t offset=pos%ring->capacity;
+	unsigned long block_index=0;
+	size_t inner_index=0;
+	size_t len=ring->capacity-offset;
+	cal_bigmem_coord(ring->mem,BIGMEM_RING_HEAD_SIZE+offset,&block_index,&inner_index);
+	if(len>ring->mem->sizes[block_index]-inner_index)
+		len=ring->mem->sizes[block_index]-inner_index;
+	return len;
+}
+
+/// @brief 预留[pos,pos+pad+size),pad为插入的填充
+/// @param[in] contig 非0时记录须位于同一内存块中
+/// @retval 0成功 -ENOSPC空间不足 -EMSGSIZE记录无法放入
+static int ring_claim(struct bigmem_ring *ring,__u64 size,int contig,__u64 *pos,__u64 *pad)
+{
+	__u64 reserve=0;
+	do
+	{
+		reserve=ring_load_acquire(&ring->head->reserve);
+		*pad=0;
+		while(contig&&ring_contig(ring,reserve+*pad)<size)
+		{
+			*pad+=ring_contig(ring,reserve+*pad);
+			if(*pad>=ring->capacity||*pad>INT_MAX)
+				return -EMSGSIZE;
+		}
+		/// 读取消费者位置,确认有足够空间
+		if(reserve+*pad+size-ring_load_acquire(&ring->head->tail)>ring->capacity)
+			return -ENOSPC;
+	}
+	while(!ring_cmpxchg(&ring->head->reserve,reserve,reserve+*pad+size));
+	*pos=reserve;
+	return 0;
+}
+
+/// @brief 等待之前预留的记录提交后发布[pos,end)
+static void ring_publish(struct bigmem_ring *ring,__u64 pos,__u64 end)
+{
+	while(ring_load_acquire(&ring->head->head)!=pos)
+		ring_relax();
+	/// 数据写入完成后再发布生产者位置
+	ring_store_release(&ring->head->head,end);
+}
+
+/// @brief 关联mem,不修改头部
+static int bind_bigmem_ring(struct bigmem_ring *ring,struct big_mem *mem)
+{
+	if(NULL==ring||NULL==mem||NULL==mem->addrs||NULL==mem->sizes)
+		return -EINVAL;
+	/// 头部须完整位于第一个内存块中
+	if(mem->sizes[0]<BIGMEM_RING_HEAD_SIZE||mem->mem_size<BIGMEM_RING_HEAD_SIZE+BIGMEM_RING_ALIGN)
+		return -EINVAL;
+	ring->mem=mem;
+	ring->head=(struct bigmem_ring_head*)mem->addrs[0];
+	return 0;
+}
+
+/// @brief 在mem上格式化环形缓冲区,清空已有数据
+/// @retval 0成功 <0失败
+int init_bigmem_ring(struct bigmem_ring *ring,struct big_mem *mem)
+{
+	int err=0;
+	if((err=bind_bigmem_ring(ring,mem))<0)
+		return err;
+	ring->capacity=(mem->mem_size-BIGMEM_RING_HEAD_SIZE)&~(__u64)(BIGMEM_RING_ALIGN-1);
+	memset(ring->head,0,sizeof(struct bigmem_ring_head));
+	ring->head->version=BIGMEM_RING_VERSION;
+	ring->head->capacity=ring->capacity;
+	/// 最后写入魔数,关联方看到魔数时其余字段已生效
+	ring_store_release(&ring->head->magic,BIGMEM_RING_MAGIC);
+	return 0;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(init_bigmem_ring);
 #endif
 
+/// @brief 关联mem上已格式化的环形缓冲区
+/// @retval 0成功 <0失败
+int attach_bigmem_ring(struct bigmem_ring *ring,struct big_mem *mem)
+{
+	int err=0;
+	if((err=bind_bigmem_ring(ring,mem))<0)
+		return err;
+	if(ring_load_acquire(&ring->head->magic)!=BIGMEM_RING_MAGIC||ring->head->version!=BIGMEM_RING_VERSION)
+		return -EINVAL;
+	ring->capacity=ring->head->capacity;
+	if(0==ring->capacity||ring->capacity%BIGMEM_RING_ALIGN!=0||ring->capacity>mem->mem_size-BIGMEM_RING_HEAD_SIZE)
+		return -EINVAL;
+	return 0;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(attach_bigmem_ring);
+#endif
 
-/// @brief 设置内存数据为data
-/// @param[in] begin,len设置内存的范围(起始，长度)
-/// @param[in] data,设置为的值
-/// @retval 0成功, <0失败
-int set_bigmem(struct big_mem *mem,size_t begin,size_t len,char data)
+/// @brief 写入一条记录,可由多个生产者并发调用
+/// @note 记录可以跨越内存块及数据区末尾,写入经过锁分段
+/// @retval 0成功 -ENOSPC空间不足 -EMSGSIZE记录过大
+int put_bigmem_ring(struct bigmem_ring *ring,const void *buf,size_t len)
 {
+	__u64 size=0;
+	__u64 pos=0;
+	__u64 pad=0;
+	__u32 record_len=(__u32)len;
 	int err=0;
-	if(NULL==mem)
+	if(NULL==ring||NULL==ring->head||(NULL==buf&&len!=0))
 		return -EINVAL;
+	size=ring_record_size(len);
+	if(len>INT_MAX||size>ring->capacity)
+		return -EMSGSIZE;
 #ifndef USER_SPACE
-	write_lock(&mem->lock);
+	/// 预留到发布期间不能被同一CPU上的其他生产者抢占,否则后者会一直等待发布
+	local_bh_disable();
 #endif
-	err=_set_bigmem(mem,begin,len,data);
+	if(0==(err=ring_claim(ring,size,0,&pos,&pad)))
+	{
+		ring_copy_in(ring,pos,&record_len,RING_RECORD_HEAD);
+		ring_copy_in(ring,pos+RING_RECORD_HEAD,buf,len);
+		ring_publish(ring,pos,pos+size);
+	}
 #ifndef USER_SPACE
-	write_unlock(&mem->lock);
+	local_bh_enable();
+	if(0==err)
+		publish_bigmem(ring->mem,len,1);
 #endif
 	return err;
 }
 #ifndef USER_SPACE
-EXPORT_SYMBOL(set_bigmem);
+EXPORT_SYMBOL(put_bigmem_ring);
 #endif
 
+/// @brief 预留一条长度为len的记录,调用者直接写入slot->data后调用commit_bigmem_ring
+/// @note 记录须位于同一内存块中,不足时在之前插入填充。内核中预留到提交期间
+/// 持有记录所在锁分段的写锁并禁止软中断,不能睡眠,也不能再预留或写入同一mem
+/// @retval 0成功 -ENOSPC空间不足 -EMSGSIZE记录超过内存块大小
+int reserve_bigmem_ring(struct bigmem_ring *ring,size_t len,struct bigmem_ring_slot *slot)
+{
+	__u64 size=0;
+	__u64 pad=0;
+	__u32 record_len=(__u32)len;
+	unsigned long block_index=0;
+	size_t inner_index=0;
+	char *addr=NULL;
+	int err=0;
+#ifndef USER_SPACE
+	struct bigmem_range range;
+#endif
+	if(NULL==ring||NULL==ring->head||NULL==slot)
+		return -EINVAL;
+	size=ring_record_size(len);
+	if(len>INT_MAX||size>ring->capacity)
+		return -EMSGSIZE;
+#ifndef USER_SPACE
+	local_bh_disable();
+#endif
+	if((err=ring_claim(ring,size,1,&slot->pos,&pad))<0)
+	{
+#ifndef USER_SPACE
+		local_bh_enable();
+#endif
+		return err;
+	}
+	if(pad!=0)
+	{
+		__u32 pad_len=BIGMEM_RING_PAD|(__u32)pad;
+		ring_copy_in(ring,slot->pos,&pad_len,RING_RECORD_HEAD);
+	}
+	slot->len=len;
+	slot->end=slot->pos+pad+size;
+	slot->offset=BIGMEM_RING_HEAD_SIZE+(slot->pos+pad)%ring->capacity;
+	cal_bigmem_coord(ring->mem,slot->offset,&block_index,&inner_index);
+	addr=(char*)ring->mem->addrs[block_index]+inner_index;
+#ifndef USER_SPACE
+	/// 记录位于同一内存块,只涉及一个锁分段
+	lock_bigmem(ring->mem,slot->offset,size,BIGMEM_LOCK_WRITE,&range);
+#endif
+	memcpy(addr,&record_len,RING_RECORD_HEAD);
+	slot->data=addr+RING_RECORD_HEAD;
+	return 0;
+}
+#ifndef USER_SPACE
+EXPORT_SYMBOL(reserve_bigmem_ring);
+#endif
 
-/// @brief 返回内存数据的长度
-size_t get_bigmem_len(const struct big_mem *mem)
+/// @brief 提交reserve_bigmem_ring预留的记录,等待之前预留的记录提交后发布
+void commit_bigmem_ring(struct bigmem_ring *ring,struct bigmem_ring_slot *slot)
 {
-	if(NULL==mem)
-		return 0;
-	return mem->mem_size;
+	unsigned long block_index=0;
+	size_t size=ring_record_size(slot->len);
+#ifndef USER_SPACE
+	struct bigmem_range range;
+	cal_bigmem_range(ring->mem,slot->offset,size,&range);
+#ifdef BIGMEM_STATS
+	range.lock_ns=0;
+#endif
+#endif
+	/// 调用者直接写入了内存块,与copy_to_blocks一样维护CRC和脏位图
+	cal_bigmem_coord(ring->mem,slot->offset,&block_index,NULL);
+	clear_block_crc(ring->mem,block_index);
+	mark_dirty(ring->mem,slot->offset,size);
+#ifndef USER_SPACE
+	/// 先释放锁分段再等待,之前的生产者可能需要同一锁分段
+	unlock_bigmem(ring->mem,&range,BIGMEM_LOCK_WRITE);
+#endif
+	ring_publish(ring,slot->pos,slot->end);
+#ifndef USER_SPACE
+	local_bh_enable();
+	publish_bigmem(ring->mem,slot->len,1);
+#endif
 }
+#ifndef USER_SPACE
+EXPORT_SYMBOL(commit_bigmem_ring);
+#endif
 
+/// @brief 读取一条记录,只允许单个消费者
+/// @retval >=0记录长度 -EAGAIN无数据 -EMSGSIZE缓冲区不足(记录保留)
+int get_bigmem_ring(struct bigmem_ring *ring,void *buf,size_t buf_size)
+{
+	__u64 tail=0;
+	__u32 record_len=0;
+	if(NULL==ring||NULL==ring->head)
+		return -EINVAL;
+	tail=ring->head->tail;
+	for(;;)
+	{
+		/// 读取生产者位置,之后的数据读取不会早于该位置的读取
+		if(ring_load_acquire(&ring->head->head)==tail)
+			return -EAGAIN;
+		ring_copy_out(ring,tail,&record_len,RING_RECORD_HEAD);
+		if(!(record_len&BIGMEM_RING_PAD))
+			break;
+		/// 跳过预留时插入的填充
+		tail+=record_len&~BIGMEM_RING_PAD;
+		ring_store_release(&ring->head->tail,tail);
+	}
+	if(record_len>buf_size)
+		return -EMSGSIZE;
+	ring_copy_out(ring,tail+RING_RECORD_HEAD,buf,record_len);
+	/// 数据读取完成后再释放空间
+	ring_store_release(&ring->head->tail,tail+ring_record_size(record_len));
+	return (int)record_len;
+}
 #ifndef USER_SPACE
-EXPORT_SYMBOL(get_bigmem_len);
+EXPORT_SYMBOL(get_bigmem_ring);
 #endif
 
-/// @breif 对比缓冲区和内存结构中的数据
-/// @param[in] begin,对比数据的首地址
-/// @param[in] buf,缓冲区首地址
-/// @param[in] size, 缓冲区大小
-/// @param[out] res memcmp的返回值
+/// @brief 快照文件,用户态同时打开直接I/O和缓冲I/O两个描述符
+struct snap_file
+{
+#ifndef USER_SPACE
+	struct file *file;
+#else    /// USER_SPACE
+	int fd;          ///< 缓冲I/O,用于头部和未对齐部分
+	int direct_fd;   ///< 直接I/O,文件系统不支持时为-1
+#endif   /// USER_SPACE
+};
+
+#define SNAP_WRITE 0x1   ///< 以读写方式打开,不存在时创建;snap_transfer中表示写入
+#define SNAP_TRUNC 0x2   ///< 清空已有文件
+#define SNAP_FAULT 0x4   ///< snap_transfer中内存不支持直接I/O时返回-EFAULT,不改用缓冲I/O
+
+/// 快照同时进行的内存块传输数
+#define BIGMEM_SNAP_DEPTH 4
+/// 内核中内存块写入期间被修改时重新写入的次数,之后加锁复制到缓冲区写入
+#define BIGMEM_SNAP_RETRY 2
+
+/// @brief 打开快照文件
+static int snap_open(struct snap_file *file,const char *path,int mode)
+{
+#ifndef USER_SPACE
+	int flags=O_LARGEFILE;
+	if(mode&SNAP_WRITE)
+		flags|=O_RDWR|O_CREAT|((mode&SNAP_TRUNC)?O_TRUNC:0);
+	else
+		flags|=O_RDONLY;
+	file->file=filp_open(path,flags,0600);
+	if(IS_ERR(file->file))
+		return PTR_ERR(file->file);
+	return 0;
+#else    /// USER_SPACE
+	int flags=0;
+	file->direct_fd=-1;
+	if(mode&SNAP_WRITE)
+		flags=O_RDWR|O_CREAT|((mode&SNAP_TRUNC)?O_TRUNC:0);
+	else
+		flags=O_RDONLY;
+	if((file->fd=open(path,flags,0644))<0)
+		return -errno;
+	file->direct_fd=open(path,(mode&SNAP_WRITE?O_RDWR:O_RDONLY)|O_DIRECT);
+	return 0;
+#endif   /// USER_SPACE
+}
+
+/// @brief 关闭快照文件,写入时先同步到存储设备
+static int snap_close(struct snap_file *file,int sync)
+{
+	int err=0;
+#ifndef USER_SPACE
+	if(sync)
+		err=vfs_fsync(file->file,0);
+	filp_close(file->file,NULL);
+#else    /// USER_SPACE
+	if(sync&&fsync(file->fd)<0)
+		err=-errno;
+	if(file->direct_fd>=0)
+		close(file->direct_fd);
+	close(file->fd);
+#endif   /// USER_SPACE
+	return err;
+}
+
+/// @brief 获取快照文件的大小
+static int snap_size(struct snap_file *file,__u64 *size)
+{
+#ifndef USER_SPACE
+	*size=i_size_read(file_inode(file->file));
+	return 0;
+#else    /// USER_SPACE
+	struct stat st;
+	if(fstat(file->fd,&st)<0)
+		return -errno;
+	*size=st.st_size;
+	return 0;
+#endif   /// USER_SPACE
+}
+
+#ifdef USER_SPACE
+/// @brief 在fd的pos处完整读写len字节
+static int snap_io(int fd,char *buf,size_t len,__u64 pos,int write)
+{
+	while(len>0)
+	{
+		ssize_t n=write?pwrite(fd,buf,len,pos):pread(fd,buf,len,pos);
+		if(n<0)
+		{
+			if(EINTR==errno)
+				continue;
+			return -errno;
+		}
+		if(0==n)
+			return -EIO;
+		buf+=n;
+		len-=n;
+		pos+=n;
+	}
+	return 0;
+}
+#endif   /// USER_SPACE
+
+/// @brief 在文件pos处完整读写len字节
+/// @note 用户态对齐部分使用直接I/O,不经过页缓存;剩余部分及不支持直接I/O时使用缓冲I/O。
+/// 可由多个线程同时调用,读写文件的不同位置
+/// @param[in] mode SNAP_WRITE,SNAP_FAULT的组合
+static int snap_transfer(struct snap_file *file,void *buf,size_t len,__u64 pos,int mode)
+{
+	int write=mode&SNAP_WRITE;
+#ifndef USER_SPACE
+	loff_t off=pos;
+	while(len>0)
+	{
+		ssize_t n=write?kernel_write(file->file,buf,len,&off):kernel_read(file->file,buf,len,&off);
+		if(n<0)
+			return n;
+		if(0==n)
+			return -EIO;
+		buf=(char*)buf+n;
+		len-=n;
+	}
+	return 0;
+#else    /// USER_SPACE
+	size_t direct=len&~(size_t)(BIGMEM_SNAP_ALIGN-1);
+	if(file->direct_fd>=0&&direct>0&&0==((unsigned long)buf&(BIGMEM_SNAP_ALIGN-1))&&0==(pos&(BIGMEM_SNAP_ALIGN-1)))
+	{
+		int err=snap_io(file->direct_fd,(char*)buf,direct,pos,write);
+		if(0==err)
+		{
+			buf=(char*)buf+direct;
+			len-=direct;
+			pos+=direct;
+		}
+		/// 内存(如设备映射)或文件系统不支持直接I/O时全部使用缓冲I/O
+		else if(err!=-EINVAL&&(err!=-EFAULT||(mode&SNAP_FAULT)))
+			return err;
+	}
+	return snap_io(file->fd,(char*)buf,len,pos,write);
+#endif   /// USER_SPACE
+}
+
+/// @brief 按mem的内存块布局生成快照头部和块表
+static void init_snap_table(struct big_mem *mem,struct bigmem_snap_head *head,struct bigmem_snap_block *blocks)
+{
+	__u64 offset=0;
+	unsigned long i=0;
+	memset(head,0,sizeof(*head));
+	head->magic=BIGMEM_SNAP_MAGIC;
+	head->version=BIGMEM_SNAP_VERSION;
+	head->head_size=sizeof(struct bigmem_snap_head);
+	head->block_size=sizeof(struct bigmem_snap_block);
+	head->mem_count=mem->mem_count;
+	head->mem_size=mem->mem_size;
+	offset=sizeof(struct bigmem_snap_head)+sizeof(struct bigmem_snap_block)*mem->mem_count;
+	head->data_offset=(offset+BIGMEM_SNAP_ALIGN-1)&~(__u64)(BIGMEM_SNAP_ALIGN-1);
+	offset=head->data_offset;
+	for(i=0;i<mem->mem_count;i++)
+	{
+		blocks[i].offset=offset;
+		blocks[i].size=mem->sizes[i];
+		blocks[i].crc=0;
+		blocks[i].reserved=0;
+		offset+=(mem->sizes[i]+BIGMEM_SNAP_ALIGN-1)&~(__u64)(BIGMEM_SNAP_ALIGN-1);
+	}
+}
+
+/// @brief 读取快照头部和块表,并检查其布局与mem一致
+/// @note 各内存块的数据须按BIGMEM_SNAP_ALIGN对齐,按顺序排列互不重叠,且完整位于文件中
 /// @retval 0成功 <0失败
-int cmp_bigmem(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res)
+static int read_snap_table(struct snap_file *file,struct big_mem *mem,struct bigmem_snap_head *head,struct bigmem_snap_block *blocks)
 {
+	__u64 file_size=0;
+	__u64 end=0;
+	unsigned long i=0;
 	int err=0;
-	if(NULL==mem)
+	if((err=snap_size(file,&file_size))<0)
+		return err;
+	if(file_size<sizeof(*head))
+		return -EINVAL;
+	if((err=snap_transfer(file,head,sizeof(*head),0,0))<0)
+		return err;
+	if(head->magic!=BIGMEM_SNAP_MAGIC||head->version!=BIGMEM_SNAP_VERSION)
+		return -EINVAL;
+	if(head->head_size!=sizeof(*head)||head->block_size!=sizeof(*blocks))
+		return -EINVAL;
+	if(head->mem_count!=mem->mem_count||head->mem_size!=mem->mem_size)
+		return -EINVAL;
+	/// 数据区在块表之后
+	end=head->head_size+sizeof(*blocks)*mem->mem_count;
+	if(end>file_size||head->data_offset<end||head->data_offset&(BIGMEM_SNAP_ALIGN-1))
 		return -EINVAL;
+	if((err=snap_transfer(file,blocks,sizeof(*blocks)*mem->mem_count,head->head_size,0))<0)
+		return err;
+	end=head->data_offset;
+	for(i=0;i<mem->mem_count;i++)
+	{
+		if(blocks[i].size!=mem->sizes[i]||blocks[i].offset<end||blocks[i].offset&(BIGMEM_SNAP_ALIGN-1))
+			return -EINVAL;
+		if(blocks[i].offset>file_size||blocks[i].size>file_size-blocks[i].offset)
+			return -EINVAL;
+		end=blocks[i].offset+blocks[i].size;
+	}
+	return 0;
+}
+
+/// @brief 快照的写入任务,BIGMEM_SNAP_DEPTH个工作者依次领取下一个内存块
+struct snap_job
+{
+	struct big_mem *mem;
+	struct snap_file *file;
+	struct bigmem_snap_block *blocks;
+	int incremental;
+	size_t buf_size;   ///< 最大内存块的大小
 #ifndef USER_SPACE
-	read_lock(&mem->lock);
-#endif
-	err=_cmp_bigmem(mem,begin,buf,buf_size,res);
+	atomic_long_t next;   ///< 下一个待领取的内存块
+	atomic_t err;   ///< 第一个错误
+#else    /// USER_SPACE
+	unsigned long next;   ///< 下一个待领取的内存块
+	int err;   ///< 第一个错误
+	int bounce;   ///< 内存不支持直接I/O(如/dev/bigmem的VM_PFNMAP映射),经过缓冲区写入
+#endif   /// USER_SPACE
+};
+
+/// @brief 快照的一个工作者
+struct snap_worker
+{
+	struct snap_job *job;
+	void *buf;   ///< 按需分配的缓冲区
 #ifndef USER_SPACE
-	read_unlock(&mem->lock);
-#endif
+	struct work_struct work;
+#else    /// USER_SPACE
+	pthread_t thread;
+#endif   /// USER_SPACE
+};
+
+/// @brief 写入一个内存块并记录其CRC32C
+/// @note 数据直接从内存块写入文件。内核中用锁分段的序列号检查写入期间没有写者,
+/// 有写者时重新写入,多次失败后加锁复制到缓冲区写入,保证CRC32C与写入的数据一致;
+/// 用户态只有内存不支持直接I/O时才复制到对齐的缓冲区
+/// @retval 0成功 <0失败
+static int snap_write_block(struct snap_worker *worker,unsigned long i)
+{
+	struct snap_job *job=worker->job;
+	struct big_mem *mem=job->mem;
+	struct bigmem_snap_block *block=&job->blocks[i];
+	__u32 crc=0;
+	int err=0;
+#ifndef USER_SPACE
+	struct bigmem_range range;
+	unsigned int seq=0;
+	int retry=0;
+	if((err=cal_bigmem_range(mem,mem->offsets[i],mem->sizes[i],&range))<0)
+		return err;
+	for(retry=0;retry<BIGMEM_SNAP_RETRY;retry++)
+	{
+		seq=read_bigmem_seq_begin(mem,&range);
+		/// 启用CRC32C缓存时,未修改的内存块不需要重新计算
+		if((err=get_bigmem_block_crc(mem,i,&crc))<0)
+			return err;
+		if(job->incremental&&block->crc==crc&&0==retry)
+			return 0;
+		if((err=snap_transfer(job->file,(void*)mem->addrs[i],mem->sizes[i],block->offset,SNAP_WRITE))<0)
+			return err;
+		if(!read_bigmem_seq_retry(mem,&range,seq))
+		{
+			block->crc=crc;
+			return 0;
+		}
+	}
+	if(NULL==worker->buf&&NULL==(worker->buf=bigmem_malloc(job->buf_size)))
+		return -ENOMEM;
+	/// 内存块位于一个锁分段中,一次加锁复制
+	if((err=read_bigmem(mem,mem->offsets[i],worker->buf,mem->sizes[i]))<0)
+		return err;
+#else    /// USER_SPACE
+	if((err=get_bigmem_block_crc(mem,i,&crc))<0)
+		return err;
+	if(job->incremental&&block->crc==crc)
+		return 0;
+	if(!__atomic_load_n(&job->bounce,__ATOMIC_RELAXED))
+	{
+		err=snap_transfer(job->file,(void*)mem->addrs[i],mem->sizes[i],block->offset,SNAP_WRITE|SNAP_FAULT);
+		if(err!=-EFAULT)
+		{
+			if(0==err)
+				block->crc=crc;
+			return err;
+		}
+		/// 设备映射的内存不能用于直接I/O,之后的内存块都经过缓冲区
+		__atomic_store_n(&job->bounce,1,__ATOMIC_RELAXED);
+	}
+	if(NULL==worker->buf&&posix_memalign(&worker->buf,BIGMEM_SNAP_ALIGN,job->buf_size)!=0)
+	{
+		worker->buf=NULL;
+		return -ENOMEM;
+	}
+	if((err=read_bigmem(mem,mem->offsets[i],worker->buf,mem->sizes[i]))<0)
+		return err;
+#endif   /// USER_SPACE
+	if((err=snap_transfer(job->file,worker->buf,mem->sizes[i],block->offset,SNAP_WRITE))<0)
+		return err;
+	block->crc=~crc32c_update(~0U,worker->buf,mem->sizes[i]);
 	return 0;
 }
-#ifndef USER_SPACE
-EXPORT_SYMBOL(cmp_bigmem);
-#endif
+
+/// @brief 工作者循环领取并写入内存块,任一工作者失败后全部停止
+static void snap_run(struct snap_worker *worker)
+{
+	struct snap_job *job=worker->job;
+	int err=0;
+	while(1)
+	{
+#ifndef USER_SPACE
+		unsigned long i=atomic_long_inc_return(&job->next)-1;
+		if(i>=job->mem->mem_count||atomic_read(&job->err)<0)
+			break;
+		if((err=snap_write_block(worker,i))<0)
+		{
+			atomic_cmpxchg(&job->err,0,err);
+			break;
+		}
+#else    /// USER_SPACE
+		int expected=0;
+		unsigned long i=__atomic_fetch_add(&job->next,1,__ATOMIC_RELAXED);
+		if(i>=job->mem->mem_count||__atomic_load_n(&job->err,__ATOMIC_RELAXED)<0)
+			break;
+		if((err=snap_write_block(worker,i))<0)
+		{
+			__atomic_compare_exchange_n(&job->err,&expected,err,0,__ATOMIC_RELAXED,__ATOMIC_RELAXED);
+			break;
+		}
+#endif   /// USER_SPACE
+	}
+}
 
 #ifndef USER_SPACE
-/// @brief 把缓冲区数据写入内存,使用bh锁
-int write_bigmem_bh(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size)
+static void snap_work(struct work_struct *work)
 {
-	int err=0;
-	if(NULL==mem)
-		return -EINVAL;
-	write_lock_bh(&mem->lock);
-	err=_write_bigmem(mem,begin,buf,buf_size);
-	write_unlock_bh(&mem->lock);
-	return err;
+	snap_run(container_of(work,struct snap_worker,work));
 }
-EXPORT_SYMBOL(write_bigmem_bh);
-/// @brief 读取数据到缓冲区 使用bh锁
-int read_bigmem_bh(struct big_mem *mem,size_t begin,void *buf,size_t buf_size)
+#else    /// USER_SPACE
+static void *snap_thread(void *data)
+{
+	snap_run((struct snap_worker*)data);
+	return NULL;
+}
+#endif   /// USER_SPACE
+
+/// @brief 并行写入需要写入的内存块
+/// @note 调用者作为第一个工作者,其余工作者在内核的unbound工作队列或用户态线程中运行,
+/// 同时最多有BIGMEM_SNAP_DEPTH个内存块在传输;创建线程失败时由已有的工作者完成
+/// @retval 0成功 <0第一个错误
+static int snap_write_blocks(struct snap_job *job)
 {
+	struct snap_worker workers[BIGMEM_SNAP_DEPTH];
+	int count=0;
+	int started=1;
+	int i=0;
 	int err=0;
-	if(NULL==mem)
-		return -EINVAL;
-	read_lock_bh(&mem->lock);
-	err=_read_bigmem(mem,begin,buf,buf_size);
-	read_unlock_bh(&mem->lock);
+	count=job->mem->mem_count<BIGMEM_SNAP_DEPTH?(int)job->mem->mem_count:BIGMEM_SNAP_DEPTH;
+	for(i=0;i<count;i++)
+	{
+		workers[i].job=job;
+		workers[i].buf=NULL;
+	}
+	for(i=1;i<count;i++)
+	{
+#ifndef USER_SPACE
+		INIT_WORK_ONSTACK(&workers[i].work,snap_work);
+		queue_work(system_unbound_wq,&workers[i].work);
+#else    /// USER_SPACE
+		if(pthread_create(&workers[i].thread,NULL,snap_thread,&workers[i])!=0)
+			break;
+#endif   /// USER_SPACE
+		started++;
+	}
+	snap_run(&workers[0]);
+	for(i=0;i<started;i++)
+	{
+		if(i>0)
+		{
+#ifndef USER_SPACE
+			flush_work(&workers[i].work);
+			destroy_work_on_stack(&workers[i].work);
+#else    /// USER_SPACE
+			pthread_join(workers[i].thread,NULL);
+#endif   /// USER_SPACE
+		}
+		bigmem_free(workers[i].buf);
+	}
+#ifndef USER_SPACE
+	err=atomic_read(&job->err);
+#else    /// USER_SPACE
+	err=job->err;
+#endif   /// USER_SPACE
 	return err;
 }
-EXPORT_SYMBOL(read_bigmem_bh);
-/// @brief 设置内存数据为data
-int set_bigmem_bh(struct big_mem *mem,size_t begin,size_t len,char data)
+
+/// @brief 将所有内存块写入快照文件
+/// @param[in] flags BIGMEM_SNAP_INCREMENTAL时只重写与已有快照不同的内存块
+/// @retval 0成功 <0失败
+int snapshot_bigmem(struct big_mem *mem,const char *path,int flags)
 {
+	struct snap_file file;
+	struct bigmem_snap_head head;
+	struct snap_job job;
+	struct bigmem_snap_block *blocks=NULL;
+	size_t table_size=0;
+	unsigned long i=0;
 	int err=0;
-	if(NULL==mem)
+	if(NULL==mem||NULL==mem->addrs||NULL==mem->sizes||NULL==path)
 		return -EINVAL;
-	write_lock_bh(&mem->lock);
-	err=_set_bigmem(mem,begin,len,data);
-	write_unlock_bh(&mem->lock);
+	table_size=sizeof(struct bigmem_snap_block)*mem->mem_count;
+	if(NULL==(blocks=(struct bigmem_snap_block*)bigmem_malloc(table_size)))
+		return -ENOMEM;
+	memset(&job,0,sizeof(job));
+	job.mem=mem;
+	job.file=&file;
+	job.blocks=blocks;
+	for(i=0;i<mem->mem_count;i++)
+		if(job.buf_size<mem->sizes[i])
+			job.buf_size=mem->sizes[i];
+#ifndef USER_SPACE
+	atomic_long_set(&job.next,0);
+	atomic_set(&job.err,0);
+#endif
+	if((err=snap_open(&file,path,(flags&BIGMEM_SNAP_INCREMENTAL)?SNAP_WRITE:SNAP_WRITE|SNAP_TRUNC))<0)
+		goto free_blocks;
+	/// 已有快照的布局不一致时写入完整快照
+	if(flags&BIGMEM_SNAP_INCREMENTAL)
+		job.incremental=read_snap_table(&file,mem,&head,blocks)==0;
+	if(!job.incremental)
+		init_snap_table(mem,&head,blocks);
+	if((err=snap_write_blocks(&job))<0)
+		goto close_file;
+	/// 数据写入后再更新块表和头部
+	if((err=snap_transfer(&file,blocks,table_size,head.head_size,SNAP_WRITE))<0)
+		goto close_file;
+	err=snap_transfer(&file,&head,sizeof(head),0,SNAP_WRITE);
+close_file:
+	if(0==err)
+		err=snap_close(&file,1);
+	else
+		snap_close(&file,0);
+free_blocks:
+	bigmem_free(blocks);
 	return err;
 }
-EXPORT_SYMBOL(set_bigmem_bh);
+#ifndef USER_SPACE
+EXPORT_SYMBOL(snapshot_bigmem);
+#endif
 
-/// @breif 对比缓冲区和内存结构中的数据
-/// @param[out] res memcmp的返回值
-/// @retval 0成功 <0失败
-int cmp_bigmem_bh(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res)
+/// @brief 从快照文件恢复所有内存块,并校验CRC32C
+/// @retval 0成功 -EIO数据校验失败 其他<0失败
+int restore_bigmem(struct big_mem *mem,const char *path)
 {
+	struct snap_file file;
+	struct bigmem_snap_head head;
+	struct bigmem_snap_block *blocks=NULL;
+	unsigned long i=0;
 	int err=0;
-	if(NULL==mem)
+	if(NULL==mem||NULL==mem->addrs||NULL==mem->sizes||NULL==path)
 		return -EINVAL;
-	read_lock_bh(&mem->lock);
-	err=_cmp_bigmem(mem,begin,buf,buf_size,res);
-	read_unlock_bh(&mem->lock);
+	if(NULL==(blocks=(struct bigmem_snap_block*)bigmem_malloc(sizeof(struct bigmem_snap_block)*mem->mem_count)))
+		return -ENOMEM;
+	if((err=snap_open(&file,path,0))<0)
+		goto free_blocks;
+	if((err=read_snap_table(&file,mem,&head,blocks))<0)
+		goto close_file;
+	for(i=0;i<mem->mem_count;i++)
+	{
+		__u32 crc=0;
+		if((err=snap_transfer(&file,(void*)mem->addrs[i],mem->sizes[i],blocks[i].offset,0))<0)
+			goto close_file;
+		/// 数据未经过写入路径,须更新CRC32C缓存和脏位图
+		invalidate_bigmem_crc(mem,mem->offsets[i],mem->sizes[i]);
+		mark_dirty(mem,mem->offsets[i],mem->sizes[i]);
+		if((err=get_bigmem_block_crc(mem,i,&crc))<0)
+			goto close_file;
+		if(crc!=blocks[i].crc)
+		{
+			err=-EIO;
+			goto close_file;
+		}
+	}
+close_file:
+	snap_close(&file,0);
+free_blocks:
+	bigmem_free(blocks);
 	return err;
 }
-EXPORT_SYMBOL(cmp_bigmem_bh);
-#endif   ///USER_SPACE
+#ifndef USER_SPACE
+EXPORT_SYMBOL(restore_bigmem);
+#endif
 
 #ifndef USER_SPACE
 /// @brief 将big_mem数据写入proc文件
 int dump_bigmem(struct big_mem *mem,char **strdata)
 {
-	const int STR_LEN=512;
+	size_t STR_LEN=0;
 	int err=0;
 	if(NULL==mem||NULL==strdata)
 		return -EINVAL;
+	/// 每个内存块一行,长度不超过64字节
+	STR_LEN=64*(mem->mem_count+1);
 	/// 分配内存
 	*strdata=(char*)kmalloc(STR_LEN,GFP_ATOMIC|GFP_KERNEL);
 	if(*strdata==NULL)
@@ -520,6 +3597,39 @@ int dump_bigmem(struct big_mem *mem,char **strdata)
 	return err;
 }
 EXPORT_SYMBOL(dump_bigmem);
+
+/// @brief 将big_mem数据序列化为二进制描述符
+/// @param[out] data 描述符,使用kvfree释放
+/// @param[out] len 描述符大小
+int dump_bigmem_desc(struct big_mem *mem,void **data,size_t *len)
+{
+	struct bigmem_desc_head *head=NULL;
+	struct bigmem_desc_block *blocks=NULL;
+	unsigned long i=0;
+	if(NULL==mem||NULL==data||NULL==len||NULL==mem->addrs)
+		return -EINVAL;
+	*len=sizeof(struct bigmem_desc_head)+sizeof(struct bigmem_desc_block)*mem->mem_count;
+	*data=kvmalloc(*len,GFP_KERNEL);
+	if(NULL==*data)
+		return -ENOMEM;
+	head=(struct bigmem_desc_head*)*data;
+	head->magic=BIGMEM_DESC_MAGIC;
+	head->version=BIGMEM_DESC_VERSION;
+	head->head_size=sizeof(struct bigmem_desc_head);
+	head->block_size=sizeof(struct bigmem_desc_block);
+	head->mem_count=mem->mem_count;
+	head->mem_size=mem->mem_size;
+	blocks=(struct bigmem_desc_block*)(head+1);
+	for(i=0;i<mem->mem_count;i++)
+	{
+		blocks[i].addr=virt_to_phys((void*)mem->addrs[i]);
+		blocks[i].size=mem->sizes[i];
+		blocks[i].node=mem->nodes!=NULL?mem->nodes[i]:-1;
+		blocks[i].reserved=0;
+	}
+	return 0;
+}
+EXPORT_SYMBOL(dump_bigmem_desc);
 #else    /// USER_SAPCE
 /// @brief 将字符串反序列化为big_mem
 int load_bigmem(struct big_mem *mem,const char *strdata)
@@ -543,16 +3653,30 @@ int load_bigmem(struct big_mem *mem,const char *strdata)
 		err=-EINVAL;
 		goto free_buf;
 	}
-	if(sscanf(tok,"%lx %zu",&mem->mem_count,&mem->mem_size)!=2)
+	if(sscanf(tok,"%lu %zu",&mem->mem_count,&mem->mem_size)!=2)
 	{
 		err=-EINVAL;
 		goto free_buf;
 	}
 	/// 分配mem->addrs,mem->sizes
+	mem->offsets=NULL;
+	mem->nodes=NULL;
+	mem->block_crcs=NULL;
+	mem->crc_valid=NULL;
+	mem->stream_threshold=0;
+	mem->dirty=NULL;
+	mem->dirty_words=0;
+	mem->dirty_shift=0;
+	mem->stats=NULL;
+	mem->base=NULL;
+	mem->base_size=0;
 	mem->addrs=(unsigned long*)malloc(sizeof(unsigned long)*mem->mem_count);
 	mem->sizes=(size_t*)malloc(sizeof(size_t)*mem->mem_count);
 	if(NULL==mem->addrs||NULL==mem->sizes)
+	{
+		err=-ENOMEM;
 		goto free_mem;
+	}
 	/// 反序列化 addrs sizes
 	for(i=0;i<mem->mem_count;i++)
 	{
@@ -562,12 +3686,16 @@ int load_bigmem(struct big_mem *mem,const char *strdata)
 			err=-EINVAL;
 			goto free_mem;
 		}
-		if(sscanf(tok,"%lx %lu",mem->addrs+i,mem->sizes+i)!=2)
+		if(sscanf(tok,"%lx %zu",mem->addrs+i,mem->sizes+i)!=2)
 		{
 			err=-EINVAL;
 			goto free_mem;
 		}
 	}
+	/// 建立块索引
+	if((err=index_bigmem(mem))<0)
+		goto free_mem;
+	free(buf);
 	return 0;
 free_mem:
 	if(mem->addrs!=NULL)
@@ -578,6 +3706,150 @@ free_buf:
 	free(buf);
 	return err;
 }
+
+/// @brief 将二进制描述符反序列化为big_mem
+int load_bigmem_desc(struct big_mem *mem,const void *data,size_t len)
+{
+	const struct bigmem_desc_head *head=(const struct bigmem_desc_head*)data;
+	const char *block=NULL;
+	unsigned long i=0;
+	int err=0;
+	if(NULL==mem||NULL==data||len<sizeof(struct bigmem_desc_head))
+		return -EINVAL;
+	/// 校验头部,兼容更大的头部和内存块描述
+	if(head->magic!=BIGMEM_DESC_MAGIC||head->version<1)
+		return -EINVAL;
+	if(head->head_size<sizeof(struct bigmem_desc_head)||head->head_size>len||head->block_size<BIGMEM_DESC_BLOCK_V1_SIZE)
+		return -EINVAL;
+	if(0==head->mem_count||(len-head->head_size)/head->block_size<head->mem_count)
+		return -EINVAL;
+	mem->mem_count=head->mem_count;
+	mem->mem_size=head->mem_size;
+	mem->offsets=NULL;
+	mem->nodes=NULL;
+	mem->block_crcs=NULL;
+	mem->crc_valid=NULL;
+	mem->stream_threshold=0;
+	mem->dirty=NULL;
+	mem->dirty_words=0;
+	mem->dirty_shift=0;
+	mem->stats=NULL;
+	mem->base=NULL;
+	mem->base_size=0;
+	mem->addrs=(unsigned long*)malloc(sizeof(unsigned long)*mem->mem_count);
+	mem->sizes=(size_t*)malloc(sizeof(size_t)*mem->mem_count);
+	mem->nodes=(int*)malloc(sizeof(int)*mem->mem_count);
+	if(NULL==mem->addrs||NULL==mem->sizes||NULL==mem->nodes)
+	{
+		err=-ENOMEM;
+		goto free_mem;
+	}
+	block=(const char*)data+head->head_size;
+	for(i=0;i<mem->mem_count;i++,block+=head->block_size)
+	{
+		const struct bigmem_desc_block *desc=(const struct bigmem_desc_block*)block;
+		mem->addrs[i]=desc->addr;
+		mem->sizes[i]=desc->size;
+		/// 版本1的描述符不含节点信息
+		mem->nodes[i]=head->block_size>=sizeof(struct bigmem_desc_block)?desc->node:-1;
+	}
+	/// 建立块索引
+	if((err=index_bigmem(mem))<0)
+		goto free_mem;
+	return 0;
+free_mem:
+	free(mem->addrs);
+	free(mem->sizes);
+	free(mem->nodes);
+	mem->addrs=NULL;
+	mem->sizes=NULL;
+	mem->nodes=NULL;
+	return err;
+}
+
+/// @brief 通过字符设备的ioctl读取二进制描述符
+int read_bigmem_desc(int fd,void **data,size_t *len)
+{
+	struct bigmem_desc_req req;
+	if(NULL==data||NULL==len)
+		return -EINVAL;
+	/// 先获取描述符大小
+	req.buf=0;
+	req.len=0;
+	if(ioctl(fd,BIGMEM_IOC_DESC,&req)<0&&errno!=ENOSPC)
+		return -errno;
+	*data=malloc(req.len);
+	if(NULL==*data)
+		return -ENOMEM;
+	req.buf=(__u64)(unsigned long)*data;
+	if(ioctl(fd,BIGMEM_IOC_DESC,&req)<0)
+	{
+		int err=-errno;
+		free(*data);
+		*data=NULL;
+		return err;
+	}
+	*len=req.len;
+	return 0;
+}
+
+/// @brief 打开字符设备用于等待数据发布,返回的文件描述符可用于poll/epoll
+/// @param[in] bytes,records 唤醒水位,为0的项不参与判断
+/// @retval >=0文件描述符 <0失败
+int open_bigmem_event(const char *path,__u64 bytes,__u64 records)
+{
+	struct bigmem_event mark;
+	int fd=0;
+	int err=0;
+	if(NULL==path)
+		return -EINVAL;
+	if((fd=open(path,O_RDONLY|O_CLOEXEC))<0)
+		return -errno;
+	mark.bytes=bytes;
+	mark.records=records;
+	if(ioctl(fd,BIGMEM_IOC_SET_WATERMARK,&mark)<0)
+	{
+		err=-errno;
+		close(fd);
+		return err;
+	}
+	return fd;
+}
+
+/// @brief 确认已处理的数据,返回自上次确认以来发布的字节数和记录数
+/// @retval 0成功 <0失败
+int ack_bigmem_event(int fd,struct bigmem_event *event)
+{
+	struct bigmem_event tmp;
+	if(ioctl(fd,BIGMEM_IOC_ACK,NULL!=event?event:&tmp)<0)
+		return -errno;
+	return 0;
+}
+
+/// @brief 通过字符设备获取并清除脏位图
+/// @param[in,out] len 缓冲区大小,返回时为位图实际大小
+/// @param[out] shift 位图粒度,可以为NULL
+/// @retval 0成功 -ENOSPC缓冲区不足(len为所需大小) 其他<0失败
+int read_bigmem_dirty(int fd,unsigned long *bitmap,size_t *len,unsigned int *shift)
+{
+	struct bigmem_dirty_req req;
+	int err=0;
+	if(NULL==len)
+		return -EINVAL;
+	memset(&req,0,sizeof(req));
+	req.buf=(unsigned long)bitmap;
+	req.len=*len;
+	if(ioctl(fd,BIGMEM_IOC_DIRTY,&req)<0)
+		err=-errno;
+	/// ENOSPC时同样返回所需大小
+	if(0==err||-ENOSPC==err)
+	{
+		*len=req.len;
+		if(NULL!=shift)
+			*shift=req.shift;
+	}
+	return err;
+}
 #endif  /// USER_SPACE
 
 #ifdef USER_SPACE
@@ -613,26 +3885,293 @@ free_mmap:
 
 }
 
+/// @breif 读取内存设备文件,将所有内存块依次映射到一段连续的虚拟地址
+/// @retval 0成功 <0失败(错误代码的负值)
+int mmap_bigmem_flat(struct big_mem *mem,int fd,int port,int flags)
+{
+	int err=0;
+	int map_index=0;
+	size_t page_size=(size_t)sysconf(_SC_PAGESIZE);
+	size_t total=0;
+	char *base=NULL;
+	if(NULL==mem||mem->addrs==NULL||NULL==mem->sizes||NULL==mem->offsets)
+		return -EINVAL;
+	/// 除末块外,内存块须按页对齐才能首尾相接
+	for(map_index=0;map_index<mem->mem_count-1;++map_index)
+		if(mem->sizes[map_index]%page_size!=0)
+			return -EINVAL;
+	total=(mem->mem_size+page_size-1)/page_size*page_size;
+	/// 预留连续的虚拟地址空间
+	base=(char*)mmap(NULL,total,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if(MAP_FAILED==base)
+		return -errno;
+	/// 依次将内存块映射到预留空间中
+	for(map_index=0;map_index<mem->mem_count;++map_index)
+	{
+		void *buf=mmap(base+mem->offsets[map_index],mem->sizes[map_index],port,flags|MAP_FIXED,fd,mem->addrs[map_index]);
+		if(MAP_FAILED==buf)
+		{
+			err=-errno;
+			munmap(base,total);
+			return err;
+		}
+	}
+	for(map_index=0;map_index<mem->mem_count;++map_index)
+		mem->addrs[map_index]=(unsigned long)(base+mem->offsets[map_index]);
+	mem->base=base;
+	mem->base_size=total;
+	return 0;
+}
+
+/// @brief 打开bigmem字符设备,以一次mmap将所有内存块映射为连续内存
+/// @note 映射后的bigmem视为单个内存块
+/// @retval 0成功 <0失败(错误代码的负值)
+int open_bigmem(struct big_mem *mem,const char *path,int port,int flags)
+{
+	struct bigmem_info info;
+	size_t page_size=(size_t)sysconf(_SC_PAGESIZE);
+	void *base=NULL;
+	int fd=0;
+	int err=0;
+	if(NULL==mem||NULL==path)
+		return -EINVAL;
+	if((fd=open(path,(port&PROT_WRITE)?O_RDWR:O_RDONLY))<0)
+		return -errno;
+	if(ioctl(fd,BIGMEM_IOC_INFO,&info)<0)
+	{
+		err=-errno;
+		close(fd);
+		return err;
+	}
+	if(0==info.mem_size)
+	{
+		close(fd);
+		return -EINVAL;
+	}
+	/// 一次映射所有内存块
+	mem->base_size=(info.mem_size+page_size-1)/page_size*page_size;
+	base=mmap(NULL,mem->base_size,port,flags,fd,0);
+	err=-errno;
+	close(fd);
+	if(MAP_FAILED==base)
+		return err;
+	mem->mem_size=info.mem_size;
+	mem->mem_count=1;
+	mem->offsets=NULL;
+	mem->nodes=NULL;
+	mem->block_crcs=NULL;
+	mem->crc_valid=NULL;
+	mem->stream_threshold=0;
+	mem->dirty=NULL;
+	mem->dirty_words=0;
+	mem->dirty_shift=0;
+	mem->stats=NULL;
+	mem->addrs=(unsigned long*)malloc(sizeof(unsigned long));
+	mem->sizes=(size_t*)malloc(sizeof(size_t));
+	if(NULL==mem->addrs||NULL==mem->sizes)
+	{
+		err=-ENOMEM;
+		goto free_mem;
+	}
+	mem->addrs[0]=(unsigned long)base;
+	mem->sizes[0]=info.mem_size;
+	if((err=index_bigmem(mem))<0)
+		goto free_mem;
+	mem->base=base;
+	return 0;
+free_mem:
+	munmap(base,mem->base_size);
+	free(mem->addrs);
+	free(mem->sizes);
+	mem->addrs=NULL;
+	mem->sizes=NULL;
+	mem->base_size=0;
+	return err;
+}
+
+/// @brief 在进程内创建bigmem结构,内存由匿名mmap分配
+/// @retval 0成功,<0失败
+int init_bigmem(struct big_mem *mem,size_t mem_size,int flags)
+{
+	return init_bigmem_attr(mem,mem_size,flags,NULL);
+}
+
+/// @brief 按属性在进程内创建bigmem结构
+/// @retval 0成功,<0失败
+int init_bigmem_attr(struct big_mem *mem,size_t mem_size,int flags,const struct bigmem_attr *attr)
+{
+	size_t page_size=(size_t)sysconf(_SC_PAGESIZE);
+	size_t block_size=mem_size;   ///< 整块大小
+	size_t map_size=0;
+	int map_flags=MAP_PRIVATE|MAP_ANONYMOUS;
+	char *base=NULL;
+	unsigned long i=0;
+	int err=0;
+	if(NULL==mem||0==mem_size)
+		return -EINVAL;
+	if(NULL!=attr&&attr->block_order!=0)
+	{
+		if(attr->block_order>=sizeof(size_t)*8-12)
+			return -EINVAL;
+		block_size=page_size<<attr->block_order;
+	}
+	/// 分配匿名内存
+	if(flags&BIGMEM_HUGETLB)
+	{
+		map_flags|=MAP_HUGETLB;
+		map_size=(mem_size+BIGMEM_HUGETLB_SIZE-1)/BIGMEM_HUGETLB_SIZE*BIGMEM_HUGETLB_SIZE;
+	}
+	else
+		map_size=(mem_size+page_size-1)/page_size*page_size;
+	if(flags&BIGMEM_POPULATE)
+		map_flags|=MAP_POPULATE;
+	base=(char*)mmap(NULL,map_size,PROT_READ|PROT_WRITE,map_flags,-1,0);
+	if(MAP_FAILED==base)
+		return -errno;
+	/// 透明大页仅为建议,失败时不影响使用
+	if(flags&BIGMEM_HUGEPAGE)
+		madvise(base,map_size,MADV_HUGEPAGE);
+	/// 按块大小划分内存块
+	mem->mem_size=mem_size;
+	mem->mem_count=(mem_size+block_size-1)/block_size;
+	mem->offsets=NULL;
+	mem->nodes=NULL;
+	mem->block_crcs=NULL;
+	mem->crc_valid=NULL;
+	mem->stream_threshold=0;
+	mem->dirty=NULL;
+	mem->dirty_words=0;
+	mem->dirty_shift=0;
+	mem->stats=NULL;
+	mem->addrs=(unsigned long*)malloc(sizeof(unsigned long)*mem->mem_count);
+	mem->sizes=(size_t*)malloc(sizeof(size_t)*mem->mem_count);
+	if(NULL==mem->addrs||NULL==mem->sizes)
+	{
+		err=-ENOMEM;
+		goto free_mem;
+	}
+	for(i=0;i<mem->mem_count;i++)
+	{
+		mem->addrs[i]=(unsigned long)(base+i*block_size);
+		mem->sizes[i]=i==mem->mem_count-1?mem_size-i*block_size:block_size;
+	}
+	if((err=index_bigmem(mem))<0)
+		goto free_mem;
+	mem->base=base;
+	mem->base_size=map_size;
+	return 0;
+free_mem:
+	munmap(base,map_size);
+	free(mem->addrs);
+	free(mem->sizes);
+	mem->addrs=NULL;
+	mem->sizes=NULL;
+	return err;
+}
+
+/// @brief 清除bigmem结构,释放init_bigmem分配或映射的内存
+void clean_bigmem(struct big_mem *mem)
+{
+	unmmap_clean_bigmem(mem);
+}
+
+/// @brief 启用统计,用户态忽略name
+/// @retval 0成功 <0失败
+int enable_bigmem_stats(struct big_mem *mem,const char *name)
+{
+#ifdef BIGMEM_STATS
+	void *stats=NULL;
+	(void)name;
+	if(NULL==mem)
+		return -EINVAL;
+	if(NULL!=mem->stats)
+		return -EBUSY;
+	if(posix_memalign(&stats,__alignof__(struct bigmem_stat_shard),sizeof(struct bigmem_stat_shard)*BIGMEM_STAT_SHARDS)!=0)
+		return -ENOMEM;
+	memset(stats,0,sizeof(struct bigmem_stat_shard)*BIGMEM_STAT_SHARDS);
+	mem->stats=(struct bigmem_stat_shard*)stats;
+	return 0;
+#else    /// BIGMEM_STATS
+	(void)mem;
+	(void)name;
+	return -EOPNOTSUPP;
+#endif   /// BIGMEM_STATS
+}
+
+/// @brief 停用统计
+void disable_bigmem_stats(struct big_mem *mem)
+{
+	if(NULL==mem)
+		return;
+	free(mem->stats);
+	mem->stats=NULL;
+}
+
+/// @brief 汇总各分片的统计
+/// @retval 0成功 <0未启用统计
+int get_bigmem_stats(struct big_mem *mem,struct bigmem_stats *stats)
+{
+#ifdef BIGMEM_STATS
+	int shard=0;
+	int i=0;
+#endif
+	if(NULL==mem||NULL==stats)
+		return -EINVAL;
+	if(NULL==mem->stats)
+		return -ENODATA;
+	memset(stats,0,sizeof(*stats));
+#ifdef BIGMEM_STATS
+	for(shard=0;shard<BIGMEM_STAT_SHARDS;shard++)
+	{
+		const struct bigmem_stats *part=&mem->stats[shard].stats;
+		for(i=0;i<BIGMEM_STAT_OPS;i++)
+		{
+			stats->ops[i]+=__atomic_load_n(&part->ops[i],__ATOMIC_RELAXED);
+			stats->bytes[i]+=__atomic_load_n(&part->bytes[i],__ATOMIC_RELAXED);
+		}
+		stats->cross_block+=__atomic_load_n(&part->cross_block,__ATOMIC_RELAXED);
+		stats->errors+=__atomic_load_n(&part->errors,__ATOMIC_RELAXED);
+	}
+#endif   /// BIGMEM_STATS
+	return 0;
+}
+
 /// @brief 取消内存设备的映射,并释放bigmem的内存
 /// @retval 0 成功 <0失败
 int unmmap_clean_bigmem(struct big_mem *mem)
 {
 	int i=0;
-	int err=0;
 	if(NULL==mem||NULL==mem->addrs||NULL==mem->sizes)
 		return -EINVAL;
 	/// 取消映射的内存
-	for(i=0;i<mem->mem_count;++i)
-		if(mem->addrs&&mem->addrs[i]!=0)
-		{
-			munmap((void*)mem->addrs[i],mem->sizes[i]);
-			mem->addrs[i]=0;
-		}
+	if(mem->base!=NULL)
+	{
+		munmap(mem->base,mem->base_size);
+		mem->base=NULL;
+		mem->base_size=0;
+	}
+	else
+	{
+		for(i=0;i<mem->mem_count;++i)
+			if(mem->addrs&&mem->addrs[i]!=0)
+			{
+				munmap((void*)mem->addrs[i],mem->sizes[i]);
+				mem->addrs[i]=0;
+			}
+	}
 	/// 释放内存
+	disable_bigmem_crc(mem);
+	disable_bigmem_dirty(mem);
+	disable_bigmem_stats(mem);
 	free(mem->sizes);
 	free(mem->addrs);
+	free(mem->offsets);
+	free(mem->nodes);
 	mem->sizes=NULL;
 	mem->addrs=NULL;
+	mem->offsets=NULL;
+	mem->nodes=NULL;
+	return 0;
 }
 
 #endif
@@ -640,12 +4179,14 @@ int unmmap_clean_bigmem(struct big_mem *mem)
 #ifndef USER_SPACE
 static int __init init_bigmem_module(void)
 {
+	bigmem_debugfs=debugfs_create_dir("bigmem",NULL);
 	printk(KERN_INFO "bigmem(v%s) module load ok!\n",VERSION);
 	return 0;
 }
 
 static void __exit cleanup_bigmem_module(void)
 {
+	debugfs_remove(bigmem_debugfs);
 	printk(KERN_INFO "bigmem(v%s) module unload ok!\n",VERSION);
 }
 
@@ -4,20 +4,216 @@
 #ifndef USER_SPACE
 
 #include <linux/rwlock_types.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock_types.h>
 #include <linux/slab.h>
-#define BIGMEM_MAX_ORDER 10    ///< 每次分配的最大order值
-#define BIGMEM_MAX_COUNT 32    ///< 分配的最大内存块个数
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/atomic.h>
+#define BIGMEM_MAX_ORDER 10    ///< 默认每次分配的order值
+
+#else    /// USER_SPACE
+
+#include <stddef.h>
+#include <linux/types.h>
+#include <sys/ioctl.h>
+
+#define BIGMEM_HUGETLB 0x1    ///< 使用MAP_HUGETLB分配大页
+#define BIGMEM_HUGEPAGE 0x2   ///< 使用透明大页(MADV_HUGEPAGE)
+#define BIGMEM_POPULATE 0x4   ///< 创建时预先分配物理页(MAP_POPULATE)
+#define BIGMEM_HUGETLB_SIZE (2UL*1024*1024)   ///< MAP_HUGETLB的大页大小
 
 #endif /// USER_SPACE
 
+#define BIGMEM_IOC_MAGIC 'B'
+
+/// @brief 字符设备返回的bigmem信息
+struct bigmem_info
+{
+	__u64 mem_size;   ///< 内存大小
+	__u64 mem_count;  ///< 内存块数量
+};
+
+/// 获取bigmem信息
+#define BIGMEM_IOC_INFO _IOR(BIGMEM_IOC_MAGIC,1,struct bigmem_info)
+
+#define BIGMEM_DESC_MAGIC 0x53444d42   ///< 二进制描述符魔数"BMDS"
+#define BIGMEM_DESC_VERSION 2          ///< 二进制描述符版本,版本2增加了节点信息
+
+/// @brief 二进制描述符头部,其后紧跟mem_count个内存块描述
+struct bigmem_desc_head
+{
+	__u32 magic;       ///< BIGMEM_DESC_MAGIC
+	__u32 version;     ///< BIGMEM_DESC_VERSION
+	__u32 head_size;   ///< 头部大小
+	__u32 block_size;  ///< 每个内存块描述的大小
+	__u64 mem_count;   ///< 内存块数量
+	__u64 mem_size;    ///< 内存大小
+};
+
+/// @brief 二进制描述符中的内存块描述
+struct bigmem_desc_block
+{
+	__u64 addr;   ///< 内存块物理地址
+	__u64 size;   ///< 内存块大小
+	__s32 node;   ///< 内存块所在的NUMA节点,-1表示未知
+	__u32 reserved;
+};
+
+/// 版本1内存块描述的大小(不含node)
+#define BIGMEM_DESC_BLOCK_V1_SIZE 16
+
+/// @brief 获取二进制描述符的请求
+struct bigmem_desc_req
+{
+	__u64 buf;   ///< 用户缓冲区地址
+	__u64 len;   ///< 缓冲区大小,返回时为描述符实际大小
+};
+
+/// 获取二进制描述符,缓冲区不足时返回ENOSPC
+#define BIGMEM_IOC_DESC _IOWR(BIGMEM_IOC_MAGIC,2,struct bigmem_desc_req)
+
+/// @brief 发布的数据量,用于设置唤醒水位和确认已处理的数据
+struct bigmem_event
+{
+	__u64 bytes;     ///< 字节数
+	__u64 records;   ///< 记录数
+};
+
+/// 设置本文件的唤醒水位,发布的字节数或记录数达到水位时poll可读
+#define BIGMEM_IOC_SET_WATERMARK _IOW(BIGMEM_IOC_MAGIC,3,struct bigmem_event)
+/// 确认已处理的数据,返回自上次确认以来发布的数据量
+#define BIGMEM_IOC_ACK _IOR(BIGMEM_IOC_MAGIC,4,struct bigmem_event)
+
+/// @brief 获取并清除脏位图的请求
+struct bigmem_dirty_req
+{
+	__u64 buf;     ///< 用户缓冲区地址,位图按unsigned long字存放
+	__u64 len;     ///< 缓冲区大小,返回时为位图实际大小
+	__u32 shift;   ///< 返回位图的粒度,每位对应2^shift字节
+	__u32 reserved;
+};
+
+/// 获取并清除脏位图,缓冲区不足时返回ENOSPC且不清除,未启用跟踪时返回ENODATA
+#define BIGMEM_IOC_DIRTY _IOWR(BIGMEM_IOC_MAGIC,5,struct bigmem_dirty_req)
+
+#define BIGMEM_NUMA_ANY 0          ///< 不指定节点
+#define BIGMEM_NUMA_BIND 1         ///< 所有内存块分配在numa_node节点
+#define BIGMEM_NUMA_INTERLEAVE 2   ///< 内存块轮流分配在各在线节点
+#define BIGMEM_NUMA_LOCAL 3        ///< 内存块分配在调用者CPU所在节点
+
+/// @brief bigmem的创建属性
+struct bigmem_attr
+{
+	unsigned int block_order;   ///< 内存块的order值,0使用默认值
+	int numa_policy;   ///< NUMA放置策略,BIGMEM_NUMA_*
+	int numa_node;     ///< BIGMEM_NUMA_BIND使用的节点
+	unsigned int lock_stripe_shift;   ///< 每个锁分段包含2^lock_stripe_shift个内存块,0表示每块一把锁
+};
+
+#define BIGMEM_RING_MAGIC 0x474e5242     ///< 环形缓冲区魔数"BRNG"
+#define BIGMEM_RING_VERSION 2
+#define BIGMEM_RING_HEAD_SIZE 4096        ///< 头部页大小,数据区紧随其后
+#define BIGMEM_RING_ALIGN 8               ///< 记录按8字节对齐
+#define BIGMEM_RING_PAD 0x80000000u       ///< 长度字段最高位置位表示填充,低位为跳过的字节数
+
+/// @brief 环形缓冲区头部,位于bigmem起始处
+/// @note reserve/head/tail为累计字节数。生产者以CAS推进reserve取得空间,
+/// 写完后按reserve的顺序推进head,因此多个生产者(包括映射了mem的其他进程)
+/// 共用头部即可串行化;tail只由消费者写入
+struct bigmem_ring_head
+{
+	__u32 magic;       ///< BIGMEM_RING_MAGIC
+	__u32 version;     ///< BIGMEM_RING_VERSION
+	__u64 capacity;    ///< 数据区大小
+	__u64 reserve __attribute__((aligned(64)));   ///< 生产者已预留的位置
+	__u64 head __attribute__((aligned(64)));      ///< 生产者已提交的位置
+	__u64 tail __attribute__((aligned(64)));      ///< 消费者位置
+};
+
+#define BIGMEM_SNAP_MAGIC 0x504e5342    ///< 快照文件魔数"BSNP"
+#define BIGMEM_SNAP_VERSION 1
+#define BIGMEM_SNAP_ALIGN 4096           ///< 内存块数据在文件中的对齐,满足直接I/O的要求
+#define BIGMEM_SNAP_INCREMENTAL 0x1      ///< 增量快照,只重写CRC32C发生变化的内存块
+
+/// @brief 快照文件头部,其后紧跟mem_count个内存块描述
+struct bigmem_snap_head
+{
+	__u32 magic;        ///< BIGMEM_SNAP_MAGIC
+	__u32 version;      ///< BIGMEM_SNAP_VERSION
+	__u32 head_size;    ///< 头部大小
+	__u32 block_size;   ///< 每个内存块描述的大小
+	__u64 mem_count;    ///< 内存块数量
+	__u64 mem_size;     ///< 内存大小
+	__u64 data_offset;  ///< 第一个内存块数据在文件中的位置
+};
+
+/// @brief 快照文件中的内存块描述
+struct bigmem_snap_block
+{
+	__u64 offset;   ///< 数据在文件中的位置,按BIGMEM_SNAP_ALIGN对齐
+	__u64 size;     ///< 内存块大小
+	__u32 crc;      ///< 写入时数据的CRC32C
+	__u32 reserved;
+};
+
+#define BIGMEM_STAT_READ 0    ///< 读取
+#define BIGMEM_STAT_WRITE 1   ///< 写入
+#define BIGMEM_STAT_SET 2     ///< 设置
+#define BIGMEM_STAT_CMP 3     ///< 对比
+#define BIGMEM_STAT_OPS 4
+#define BIGMEM_STAT_BUCKETS 32   ///< 直方图第i个桶统计[2^i,2^(i+1))纳秒,最后一个桶包含更长的时间
+
+/// @brief 操作统计,内核中每个CPU一份,用户态按CPU分片,读取时汇总
+/// @note 用户态没有锁分段,lock_wait和lock_hold总为0
+struct bigmem_stats
+{
+	__u64 ops[BIGMEM_STAT_OPS];     ///< 各类操作次数
+	__u64 bytes[BIGMEM_STAT_OPS];   ///< 各类操作字节数
+	__u64 cross_block;              ///< 跨越内存块边界的操作次数
+	__u64 errors;                   ///< 返回错误的操作次数
+	__u64 lock_wait[BIGMEM_STAT_BUCKETS];   ///< 等待锁分段的时间直方图
+	__u64 lock_hold[BIGMEM_STAT_BUCKETS];   ///< 持有锁分段的时间直方图
+};
+
+struct bigmem_dev;
+struct bigmem_stat_shard;
+struct bigmem_stripe;
+struct dentry;
+
 struct big_mem
 {
 	unsigned long *addrs;   ///< 内存块首地址数组
 	size_t *sizes;   ///< 内存块大小数组
 	unsigned long mem_count;  ///< 内存块数量
 	size_t mem_size;  ///< 内存大小
+	size_t *offsets;  ///< 内存块起始位置数组(前缀和),共mem_count+1项
+	int *nodes;   ///< 各内存块所在的NUMA节点,NULL表示未知
+	unsigned int block_shift;   ///< 前部等大内存块大小的log2值
+	unsigned long uniform_count;   ///< 前部等大内存块的数量
+	void *base;   ///< 所有内存块的连续映射首地址,NULL表示未建立连续映射
+	size_t base_size;   ///< 连续映射的长度
+	__u32 *block_crcs;   ///< 各内存块缓存的CRC32C,NULL表示未启用缓存
+	unsigned long *crc_valid;   ///< 缓存有效位图,写入内存块时清除
+	size_t stream_threshold;   ///< 单次写入/设置不小于该长度时使用非临时存储,0表示不使用
 #ifndef USER_SPACE
-	rwlock_t lock;          ///< 锁
+	atomic_long_t *dirty;   ///< 脏位图,NULL表示未启用脏数据跟踪
+#else    /// USER_SPACE
+	unsigned long *dirty;   ///< 脏位图,NULL表示未启用脏数据跟踪
+#endif   /// USER_SPACE
+	unsigned long dirty_words;   ///< 脏位图的字数
+	unsigned int dirty_shift;    ///< 每位对应2^dirty_shift字节
+#ifdef USER_SPACE
+	struct bigmem_stat_shard *stats;   ///< 按CPU分片的统计,NULL表示未启用
+#else    /// USER_SPACE
+	struct bigmem_stripe *stripes;   ///< 锁分段数组,每个分段保护一组连续内存块
+	unsigned long stripe_count;     ///< 锁分段数量
+	unsigned int stripe_shift;      ///< 每个锁分段包含2^stripe_shift个内存块
+	rwlock_t big_lock;   ///< 实例锁,获取锁分段前加读锁,超过8个锁分段的操作加写锁独占整个实例
+	seqcount_rwlock_t big_seq;   ///< 独占整个实例的写者递增的序列号,供无锁读使用
+	struct bigmem_dev __rcu *dev;  ///< 注册的字符设备
+	struct bigmem_stats __percpu *stats;   ///< 每CPU统计,NULL表示未启用
+	struct dentry *stats_file;   ///< debugfs统计文件
 #endif   /// USER_SPACE
 };
 
@@ -27,19 +223,61 @@ struct big_mem
 /// @param[in] size 内存大小
 /// @retval 0成功,<0失败
 int init_bigmem(struct big_mem *mem,size_t size,gfp_t flags);
+/// @brief 按属性初始化bigmem结构
+/// @param[in] attr 创建属性,NULL使用默认值
+/// @retval 0成功,<0失败
+int init_bigmem_attr(struct big_mem *mem,size_t size,gfp_t flags,const struct bigmem_attr *attr);
 /// @brief 清除bigmem结构
 void clean_bigmem(struct big_mem *mem);
+/// @brief 返回已分配但未使用的物理内存字节数
+size_t get_bigmem_overhead(const struct big_mem *mem);
+/// @brief 将所有内存块映射到一段连续的内核虚拟地址,之后可用get_bigmem_ptr直接访问
+/// @note 可能睡眠,只能在进程上下文调用
+/// @retval 0成功,<0失败
+int vmap_bigmem(struct big_mem *mem);
+/// @brief 取消vmap_bigmem建立的连续映射
+void vunmap_bigmem(struct big_mem *mem);
+/// @brief 注册字符设备/dev/name,用户态可通过一次mmap映射所有内存块
+/// @retval 0成功,<0失败
+int register_bigmem_dev(struct big_mem *mem,const char *name);
+/// @brief 注销register_bigmem_dev注册的字符设备
+/// @note 已打开的文件此后返回-ENODEV;已映射的内存块在所有映射解除后才释放
+void unregister_bigmem_dev(struct big_mem *mem);
+/// @brief 发布新写入的数据,唤醒poll字符设备且达到水位的进程
+/// @note write_bigmem,write_bigmem_bh及put_bigmem_ring成功后自动发布
+void publish_bigmem(struct big_mem *mem,size_t bytes,unsigned long records);
 #else   /// USER_SPACE
 
+/// @brief 在进程内创建bigmem结构,内存由匿名mmap分配
+/// @param[in] flags BIGMEM_HUGETLB,BIGMEM_HUGEPAGE,BIGMEM_POPULATE的组合
+/// @retval 0成功,<0失败
+int init_bigmem(struct big_mem *mem,size_t size,int flags);
+/// @brief 按属性在进程内创建bigmem结构
+/// @param[in] attr 创建属性,block_order为0时整个内存作为一个内存块
+/// @retval 0成功,<0失败
+int init_bigmem_attr(struct big_mem *mem,size_t size,int flags,const struct bigmem_attr *attr);
+/// @brief 清除bigmem结构,释放init_bigmem分配或映射的内存
+void clean_bigmem(struct big_mem *mem);
+
 /// @breif 读取内存设备文件，映射bigmem结构
 /// @retval 0成功 -1失败
 int mmap_bigmem(struct big_mem *mem,int fd,int port,int flags);
+/// @brief 读取内存设备文件,将所有内存块依次映射到一段连续的虚拟地址
+/// @note 映射后base+offset在整个mem_size范围内有效,除末块外的内存块大小须为页大小的整数倍
+/// @retval 0成功 <0失败
+int mmap_bigmem_flat(struct big_mem *mem,int fd,int port,int flags);
+/// @brief 打开bigmem字符设备,以一次mmap将所有内存块映射为连续内存
+/// @param[in] path 字符设备路径,如/dev/bigmem
+/// @retval 0成功 <0失败
+int open_bigmem(struct big_mem *mem,const char *path,int port,int flags);
 /// @brief 取消内存设备的映射,并释放bigmem的内存
 /// @retval 0 成功 <0失败
 int unmmap_clean_bigmem(struct big_mem *mem);
 #endif   /// USER_SPACE
 
 /// @brief 把缓冲区数据写入内存
+/// @note 内核中整个写入在一次加锁内完成,读写/设置/对比及批量接口相同;
+/// 涉及超过8个锁分段时独占整个实例,期间其他访问等待
 /// @param[in] begin,写入到mem的位置
 /// @param[in] buf,缓冲区首地址
 /// @param[in] size, 缓冲区大小
@@ -63,6 +301,34 @@ int set_bigmem(struct big_mem *mem,size_t begin,size_t len,char data);
 /// @brief 返回内存数据的长度
 size_t get_bigmem_len(const struct big_mem *mem);
 
+/// @brief 返回内存位置begin所在内存块的NUMA节点
+/// @retval 节点号,未知或越界时返回-1
+int get_bigmem_node(struct big_mem *mem,size_t begin);
+
+/// @brief 设置流式写入的阈值,单次写入或设置不小于threshold字节时绕过CPU缓存
+/// @param[in] threshold 0表示关闭流式写入
+/// @note 用于初始化或整块填充大内存,避免驱逐缓存中的热数据
+void set_bigmem_stream_threshold(struct big_mem *mem,size_t threshold);
+
+/// @brief 启用脏数据跟踪,写入和设置操作标记所在的2^shift字节区间
+/// @note 通过get_bigmem_ptr或mmap直接写入的数据不会被标记
+/// @retval 0成功 <0失败
+int enable_bigmem_dirty(struct big_mem *mem,unsigned int shift);
+/// @brief 停用脏数据跟踪并释放位图
+void disable_bigmem_dirty(struct big_mem *mem);
+/// @brief 返回脏位图的字节数,未启用时返回0
+size_t get_bigmem_dirty_len(const struct big_mem *mem);
+/// @brief 获取并清除脏位图,每个字原子地交换为0
+/// @note 在数据写入之后标记,获取到的位对应的数据不早于本次获取前完成的写入
+/// @param[out] bitmap 位图,第i位对应[i<<shift,(i+1)<<shift)
+/// @param[out] count 脏区间数量,可以为NULL
+/// @retval 0成功 -ENOSPC缓冲区不足 其他<0失败
+int fetch_bigmem_dirty(struct big_mem *mem,unsigned long *bitmap,size_t len,size_t *count);
+
+/// @brief 返回内存位置begin在连续映射中的指针
+/// @retval 未建立连续映射或越界时返回NULL
+void *get_bigmem_ptr(struct big_mem *mem,size_t begin);
+
 /// @breif 对比缓冲区和内存结构中的数据
 /// @param[in] begin,对比数据的首地址
 /// @param[in] buf,缓冲区首地址
@@ -71,12 +337,168 @@ size_t get_bigmem_len(const struct big_mem *mem);
 /// @retval 0成功 -1失败
 int cmp_bigmem(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res);
 
+/// @breif 对比缓冲区和内存结构中的数据,并返回第一个不相等字节的位置
+/// @param[out] res memcmp的返回值
+/// @param[out] diff 第一个不相等字节在mem中的位置,全部相等时为begin+buf_size
+/// @retval 0成功 <0失败
+int cmp_bigmem_diff(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res,size_t *diff);
+
+/// @brief 在[begin,begin+len)内查找pattern第一次出现的位置,可跨越内存块边界
+/// @note 时间与len成线性;pattern_len大于1时分配失配表,内核中不能在原子上下文调用
+/// @param[out] pos 找到的位置
+/// @retval 0找到 -ENOENT未找到 -EINVAL参数错误 其他<0失败
+int find_bigmem(struct big_mem *mem,size_t begin,size_t len,const void *pattern,size_t pattern_len,size_t *pos);
+
+/// @brief 在[begin,begin+len)内查找字节data第一次出现的位置
+/// @param[out] pos 找到的位置
+/// @retval 0找到 -ENOENT未找到 其他<0失败
+int memchr_bigmem(struct big_mem *mem,size_t begin,size_t len,char data,size_t *pos);
+
+/// @brief 计算[begin,begin+len)的CRC32C,可分段累计计算
+/// @param[in,out] crc 传入之前各段的结果(首段为0),返回累计到本段的结果
+/// @retval 0成功 <0失败
+int crc32c_bigmem(struct big_mem *mem,size_t begin,size_t len,__u32 *crc);
+
+/// @brief 启用各内存块CRC32C缓存,须在并发访问开始前调用
+/// @note 通过get_bigmem_ptr或mmap直接写入内存时,须调用invalidate_bigmem_crc
+/// @retval 0成功 <0失败
+int enable_bigmem_crc(struct big_mem *mem);
+/// @brief 停用并释放CRC32C缓存
+void disable_bigmem_crc(struct big_mem *mem);
+/// @brief 获取内存块block_index的CRC32C,缓存有效时不重新计算
+/// @retval 0成功 <0失败
+int get_bigmem_block_crc(struct big_mem *mem,unsigned long block_index,__u32 *crc);
+/// @brief 使与[begin,begin+len)相交的内存块的CRC32C缓存失效
+void invalidate_bigmem_crc(struct big_mem *mem,size_t begin,size_t len);
+
+/// @brief 批量操作的一项
+struct bigmem_vec
+{
+	size_t begin;   ///< mem的位置
+	void *buf;      ///< 缓冲区首地址,批量设置时不使用
+	size_t len;     ///< 长度
+};
+
+/// @brief 批量写入,内核中涉及的锁分段不超过8个时所有项在一次加锁内完成
+/// @retval 0成功, <0失败(任一项越界时不写入任何数据)
+int writev_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count);
+/// @brief 批量读取,内核中涉及的锁分段不超过8个时所有项在一次加锁内完成
+int readv_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count);
+/// @brief 批量设置内存数据为data,忽略各项的buf
+int setv_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count,char data);
+/// @brief 批量对比,遇到第一个不相等的项时停止
+/// @param[out] res 第一个不相等项的memcmp结果,全部相等时为0
+int cmpv_bigmem(struct big_mem *mem,const struct bigmem_vec *vec,int count,int *res);
+
+/// @brief 启用统计,内核中并创建debugfs文件bigmem/name,用户态忽略name
+/// @note 须在并发访问开始前调用;编译时未定义BIGMEM_STATS时返回-EOPNOTSUPP
+/// @retval 0成功 <0失败
+int enable_bigmem_stats(struct big_mem *mem,const char *name);
+/// @brief 停用统计并删除debugfs文件,须在没有并发访问时调用
+void disable_bigmem_stats(struct big_mem *mem);
+/// @brief 汇总各CPU的统计
+/// @retval 0成功 <0未启用统计
+int get_bigmem_stats(struct big_mem *mem,struct bigmem_stats *stats);
+
+#ifndef USER_SPACE
+
+/// @brief 批量写入,使用bh锁
+int writev_bigmem_bh(struct big_mem *mem,const struct bigmem_vec *vec,int count);
+/// @brief 批量读取,使用bh锁
+int readv_bigmem_bh(struct big_mem *mem,const struct bigmem_vec *vec,int count);
+/// @brief 批量设置内存数据,使用bh锁
+int setv_bigmem_bh(struct big_mem *mem,const struct bigmem_vec *vec,int count,char data);
+/// @brief 批量对比,使用bh锁
+int cmpv_bigmem_bh(struct big_mem *mem,const struct bigmem_vec *vec,int count,int *res);
+#endif   /// USER_SPACE
+
+/// @brief bigmem上的环形缓冲区,记录格式为4字节长度+数据,按8字节对齐
+/// @note 生产者之间的同步全部在共享的头部中,内核与用户态不能同时作为同一缓冲区的生产者
+struct bigmem_ring
+{
+	struct big_mem *mem;             ///< 所在的bigmem
+	struct bigmem_ring_head *head;   ///< 头部
+	__u64 capacity;                  ///< 数据区大小
+};
+
+/// @brief reserve_bigmem_ring预留的一条记录
+struct bigmem_ring_slot
+{
+	void *data;      ///< 记录数据的地址,位于同一内存块中,可直接写入
+	size_t len;      ///< 记录长度
+	size_t offset;   ///< 记录头部在mem中的位置
+	__u64 pos;       ///< 预留的起始位置,包括之前的填充
+	__u64 end;       ///< 预留的结束位置
+};
+
+/// @brief 在mem上格式化环形缓冲区,清空已有数据
+/// @retval 0成功 <0失败
+int init_bigmem_ring(struct bigmem_ring *ring,struct big_mem *mem);
+
+/// @brief 关联mem上已格式化的环形缓冲区
+/// @retval 0成功 <0失败
+int attach_bigmem_ring(struct bigmem_ring *ring,struct big_mem *mem);
+
+/// @brief 写入一条记录,可由多个生产者并发调用
+/// @note 记录可以跨越内存块及数据区末尾,写入经过锁分段
+/// @retval 0成功 -ENOSPC空间不足 -EMSGSIZE记录过大
+int put_bigmem_ring(struct bigmem_ring *ring,const void *buf,size_t len);
+
+/// @brief 预留一条长度为len的记录,调用者直接写入slot->data后调用commit_bigmem_ring
+/// @note 记录须位于同一内存块中,不足时在之前插入填充。内核中预留到提交期间
+/// 持有记录所在锁分段的写锁并禁止软中断,不能睡眠,也不能再预留或写入同一mem
+/// @retval 0成功 -ENOSPC空间不足 -EMSGSIZE记录超过内存块大小
+int reserve_bigmem_ring(struct bigmem_ring *ring,size_t len,struct bigmem_ring_slot *slot);
+
+/// @brief 提交reserve_bigmem_ring预留的记录,等待之前预留的记录提交后发布
+void commit_bigmem_ring(struct bigmem_ring *ring,struct bigmem_ring_slot *slot);
+
+/// @brief 读取一条记录,只允许单个消费者
+/// @retval >=0记录长度 -EAGAIN无数据 -EMSGSIZE缓冲区不足(记录保留)
+int get_bigmem_ring(struct bigmem_ring *ring,void *buf,size_t buf_size);
+
+/// @brief 将所有内存块写入快照文件
+/// @param[in] flags BIGMEM_SNAP_INCREMENTAL时只重写与已有快照不同的内存块,
+///            已有快照的布局与mem不一致时写入完整快照
+/// @note 同时写入最多4个内存块,数据直接从内存块写入文件,用户态只有/dev/bigmem映射的内存经过缓冲区。
+/// 内核中不阻塞并发写入,写入期间被修改的内存块重新写入,CRC32C与写入的数据一致,须在进程上下文调用;
+/// 用户态不加锁,快照期间应停止写入,否则恢复时可能校验失败
+/// @retval 0成功 <0失败
+int snapshot_bigmem(struct big_mem *mem,const char *path,int flags);
+
+/// @brief 从快照文件恢复所有内存块,并校验CRC32C
+/// @note 快照的内存块布局须与mem一致;恢复期间不应有并发访问
+/// @retval 0成功 -EIO数据校验失败 其他<0失败
+int restore_bigmem(struct big_mem *mem,const char *path);
+
 #ifndef USER_SPACE
 /// @brief 将big_mem数据序列化为字符串
 int dump_bigmem(struct big_mem *mem,char **strdata);
+/// @brief 将big_mem数据序列化为二进制描述符
+/// @param[out] data 描述符,使用kvfree释放
+/// @param[out] len 描述符大小
+int dump_bigmem_desc(struct big_mem *mem,void **data,size_t *len);
 #else    /// USER_SAPCE
 /// @brief 将字符串反序列化为big_mem
 int load_bigmem(struct big_mem *mem,const char *strdata);
+/// @brief 将二进制描述符反序列化为big_mem
+int load_bigmem_desc(struct big_mem *mem,const void *data,size_t len);
+/// @brief 打开字符设备用于等待数据发布,返回的文件描述符可用于poll/epoll
+/// @param[in] bytes,records 唤醒水位,为0的项不参与判断
+/// @retval >=0文件描述符 <0失败
+int open_bigmem_event(const char *path,__u64 bytes,__u64 records);
+/// @brief 确认已处理的数据,返回自上次确认以来发布的字节数和记录数
+/// @retval 0成功 <0失败
+int ack_bigmem_event(int fd,struct bigmem_event *event);
+/// @brief 通过字符设备获取并清除脏位图
+/// @param[in,out] len 缓冲区大小,返回时为位图实际大小
+/// @param[out] shift 位图粒度
+/// @retval 0成功 <0失败
+int read_bigmem_dirty(int fd,unsigned long *bitmap,size_t *len,unsigned int *shift);
+/// @brief 通过字符设备的ioctl读取二进制描述符
+/// @param[out] data 描述符,使用free释放
+/// @param[out] len 描述符大小
+int read_bigmem_desc(int fd,void **data,size_t *len);
 #endif  /// USER_SPACE
 
 #ifndef USER_SPACE
@@ -91,6 +513,13 @@ int set_bigmem_bh(struct big_mem *mem,size_t begin,size_t len,char data);
 
 /// @breif 对比缓冲区和内存结构中的数据
 int cmp_bigmem_bh(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res);
+
+/// @brief 读取数据到缓冲区,不加锁,读取期间有写入时重试
+/// @note 读者不写共享缓存行;在软中断中使用时,写者须使用_bh版本
+int read_bigmem_seq(struct big_mem *mem,size_t begin,void *buf,size_t buf_size);
+
+/// @breif 对比缓冲区和内存结构中的数据,不加锁,对比期间有写入时重试
+int cmp_bigmem_seq(struct big_mem *mem,size_t begin,const void *buf,size_t buf_size,int *res);
 #endif   ///USER_SPACE
 
 #endif  //BIG_MEM_H
@@ -0,0 +1,112 @@
+/// @file bigmem_trace.h
+/// @brief bigmem静态跟踪点,未启用时只有一个static key分支
+/// @note 通过/sys/kernel/tracing/events/bigmem/或perf -e 'bigmem:*'启用
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM bigmem
+
+#if !defined(BIGMEM_TRACE_H)||defined(TRACE_HEADER_MULTI_READ)
+#define BIGMEM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#define show_bigmem_op(op)                   \
+	__print_symbolic(op,                     \
+		{ BIGMEM_STAT_READ,  "read" },       \
+		{ BIGMEM_STAT_WRITE, "write" },      \
+		{ BIGMEM_STAT_SET,   "set" },        \
+		{ BIGMEM_STAT_CMP,   "cmp" })
+
+/// @brief 分配一个内存块
+TRACE_EVENT(bigmem_alloc_block,
+	TP_PROTO(const void *mem,unsigned long index,unsigned int order,int node,u64 duration_ns),
+	TP_ARGS(mem,index,order,node,duration_ns),
+	TP_STRUCT__entry(
+		__field(const void *,mem)
+		__field(unsigned long,index)
+		__field(unsigned int,order)
+		__field(int,node)
+		__field(u64,duration_ns)
+	),
+	TP_fast_assign(
+		__entry->mem=mem;
+		__entry->index=index;
+		__entry->order=order;
+		__entry->node=node;
+		__entry->duration_ns=duration_ns;
+	),
+	TP_printk("mem=%p index=%lu order=%u node=%d duration_ns=%llu",
+		__entry->mem,__entry->index,__entry->order,__entry->node,__entry->duration_ns)
+);
+
+/// @brief init_bigmem完成,err<0时为失败
+TRACE_EVENT(bigmem_init,
+	TP_PROTO(const void *mem,size_t mem_size,unsigned long blocks,u64 duration_ns,int err),
+	TP_ARGS(mem,mem_size,blocks,duration_ns,err),
+	TP_STRUCT__entry(
+		__field(const void *,mem)
+		__field(size_t,mem_size)
+		__field(unsigned long,blocks)
+		__field(u64,duration_ns)
+		__field(int,err)
+	),
+	TP_fast_assign(
+		__entry->mem=mem;
+		__entry->mem_size=mem_size;
+		__entry->blocks=blocks;
+		__entry->duration_ns=duration_ns;
+		__entry->err=err;
+	),
+	TP_printk("mem=%p size=%zu blocks=%lu duration_ns=%llu err=%d",
+		__entry->mem,__entry->mem_size,__entry->blocks,__entry->duration_ns,__entry->err)
+);
+
+/// @brief clean_bigmem释放内存
+TRACE_EVENT(bigmem_clean,
+	TP_PROTO(const void *mem,size_t mem_size,unsigned long blocks),
+	TP_ARGS(mem,mem_size,blocks),
+	TP_STRUCT__entry(
+		__field(const void *,mem)
+		__field(size_t,mem_size)
+		__field(unsigned long,blocks)
+	),
+	TP_fast_assign(
+		__entry->mem=mem;
+		__entry->mem_size=mem_size;
+		__entry->blocks=blocks;
+	),
+	TP_printk("mem=%p size=%zu blocks=%lu",
+		__entry->mem,__entry->mem_size,__entry->blocks)
+);
+
+/// @brief 一次读写/设置/对比,blocks为涉及的内存块数
+TRACE_EVENT(bigmem_access,
+	TP_PROTO(const void *mem,int op,size_t begin,size_t len,unsigned long block,unsigned long blocks),
+	TP_ARGS(mem,op,begin,len,block,blocks),
+	TP_STRUCT__entry(
+		__field(const void *,mem)
+		__field(int,op)
+		__field(size_t,begin)
+		__field(size_t,len)
+		__field(unsigned long,block)
+		__field(unsigned long,blocks)
+	),
+	TP_fast_assign(
+		__entry->mem=mem;
+		__entry->op=op;
+		__entry->begin=begin;
+		__entry->len=len;
+		__entry->block=block;
+		__entry->blocks=blocks;
+	),
+	TP_printk("mem=%p op=%s begin=%zu len=%zu block=%lu blocks=%lu",
+		__entry->mem,show_bigmem_op(__entry->op),__entry->begin,__entry->len,
+		__entry->block,__entry->blocks)
+);
+
+#endif   /// BIGMEM_TRACE_H
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE bigmem_trace
+#include <trace/define_trace.h>
@@ -4,7 +4,15 @@
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
 #else    /// USER_SPACE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   ///< splice
+#endif
 #include <stdlib.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -14,12 +22,18 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <pthread.h>
 #include <error.h>
+#include <time.h>
 #endif   ///USER_SPACE
 
 #include "bigmem.h"
 
 #define PROC_NAME "bigmem"
+#define DEV_NAME "bigmem"
 
 struct big_mem g_mem;
 
@@ -42,9 +56,23 @@ ssize_t procfile_read(struct file* f,char *buf,size_t count,loff_t *offp)
 	return count;
 }
 
+/// @brief 写入的数据经write_bigmem写到内存开头,作为一条记录发布给字符设备的等待者
+ssize_t procfile_write(struct file *f,const char __user *buf,size_t count,loff_t *offp)
+{
+	char data[64];
+	if(count>sizeof(data))
+		count=sizeof(data);
+	if(copy_from_user(data,buf,count))
+		return -EFAULT;
+	if(write_bigmem(&g_mem,0,data,count)<0)
+		return -EIO;
+	return count;
+}
+
 static const struct file_operations fops={
 	.owner=THIS_MODULE,
 	.read=procfile_read,
+	.write=procfile_write,
 };
 
 static int alloc_mem(struct big_mem *mem,size_t size)
@@ -54,6 +82,9 @@ static int alloc_mem(struct big_mem *mem,size_t size)
 		printk("init bigmem failed\n");
 		return -1;
 	}
+	printk("bigmem %lu blocks, overhead %zu bytes\n",mem->mem_count,get_bigmem_overhead(mem));
+	if(enable_bigmem_stats(mem,DEV_NAME)<0)
+		printk("enable_bigmem_stats failed\n");
 	if(dump_bigmem(mem,&read_buf)<0)
 		read_buf=NULL;
 	temp=strlen(read_buf);
@@ -104,7 +135,7 @@ static int test_write_read(struct big_mem *mem)
 
 static int create_proc_file(struct big_mem *mem)
 {
-	proc_file=proc_create(PROC_NAME,0444,NULL,&fops);
+	proc_file=proc_create(PROC_NAME,0644,NULL,&fops);
 	if(NULL==proc_file)
 	{
 		printk("could not initialize /proc/%s",PROC_NAME);
@@ -168,6 +199,201 @@ static int test_set(struct big_mem *mem)
 	return -1;
 }
 
+/// @brief 整块读写bigmem,并输出吞吐量
+static int test_bulk(struct big_mem *mem)
+{
+	const int loops=16;
+	size_t len=get_bigmem_len(mem);
+	char *buf=NULL;
+	char *buf_copy=NULL;
+	ktime_t start;
+	s64 write_ns,read_ns,set_ns;
+	int stream=0;
+	int err=0;
+	int i=0;
+	buf=vmalloc(len);
+	buf_copy=vmalloc(len);
+	if(NULL==buf||NULL==buf_copy)
+	{
+		err=-ENOMEM;
+		goto free_buf;
+	}
+	for(i=0;i<len;i++)
+		buf[i]=(char)i;
+	/// 单次调用完成跨越所有内存块的读写
+	start=ktime_get();
+	for(i=0;i<loops&&err==0;i++)
+		err=write_bigmem(mem,0,buf,len);
+	write_ns=ktime_to_ns(ktime_sub(ktime_get(),start));
+	start=ktime_get();
+	for(i=0;i<loops&&err==0;i++)
+		err=read_bigmem(mem,0,buf_copy,len);
+	read_ns=ktime_to_ns(ktime_sub(ktime_get(),start));
+	if(err<0)
+	{
+		printk("bulk write/read failed\n");
+		goto free_buf;
+	}
+	if(memcmp(buf,buf_copy,len)!=0)
+	{
+		printk("bulk data not match\n");
+		err=-1;
+		goto free_buf;
+	}
+	printk("bulk write %lld MB/s, read %lld MB/s\n",
+			write_ns>0?(s64)len*loops*1000/write_ns:0,
+			read_ns>0?(s64)len*loops*1000/read_ns:0);
+	/// 对比普通设置与流式设置(memcpy_flushcache)的吞吐量
+	for(stream=0;stream<2&&err==0;stream++)
+	{
+		set_bigmem_stream_threshold(mem,stream?PAGE_SIZE:0);
+		start=ktime_get();
+		for(i=0;i<loops&&err==0;i++)
+			err=set_bigmem(mem,0,len,0);
+		set_ns=ktime_to_ns(ktime_sub(ktime_get(),start));
+		printk("bulk %s set %lld MB/s\n",stream?"stream":"cached",
+				set_ns>0?(s64)len*loops*1000/set_ns:0);
+	}
+	set_bigmem_stream_threshold(mem,0);
+free_buf:
+	if(buf!=NULL)
+		vfree(buf);
+	if(buf_copy!=NULL)
+		vfree(buf_copy);
+	return err;
+}
+
+/// @brief 通过连续映射跨块写入,再用read_bigmem校验
+static int test_vmap(struct big_mem *mem)
+{
+	const char *str="vmap across blocks";
+	const int len=strlen(str);
+	size_t start=4*1024*1024-5;
+	char buf[64];
+	char *ptr=NULL;
+	int err=0;
+	if((err=vmap_bigmem(mem))<0)
+	{
+		printk("vmap_bigmem failed\n");
+		return err;
+	}
+	if((ptr=get_bigmem_ptr(mem,start))==NULL)
+	{
+		printk("get_bigmem_ptr failed\n");
+		return -1;
+	}
+	memcpy(ptr,str,len);
+	if((err=read_bigmem(mem,start,buf,len))<0)
+	{
+		printk("read_bigmem failed\n");
+		return err;
+	}
+	if(memcmp(buf,str,len)==0)
+		return 0;
+	return -1;
+}
+
+#define READ_BENCH_LOOPS 1000000
+
+/// @brief 读扩展性测试的共享参数
+struct read_bench
+{
+	struct big_mem *mem;
+	int seq;                  ///< 非0时使用read_bigmem_seq
+	atomic_t running;         ///< 未结束的线程数
+	struct completion done;   ///< 所有线程结束
+};
+
+static int read_bench_thread(void *data)
+{
+	struct read_bench *bench=(struct read_bench*)data;
+	size_t range=get_bigmem_len(bench->mem)-64;
+	char buf[64];
+	int i=0;
+	for(i=0;i<READ_BENCH_LOOPS;i++)
+	{
+		size_t begin=((size_t)i*4096)%range;
+		if(bench->seq)
+			read_bigmem_seq(bench->mem,begin,buf,sizeof(buf));
+		else
+			read_bigmem(bench->mem,begin,buf,sizeof(buf));
+	}
+	if(atomic_dec_and_test(&bench->running))
+		complete(&bench->done);
+	return 0;
+}
+
+/// @brief 在threads个CPU上并发读取,返回耗时(ns)
+static s64 run_read_bench(struct big_mem *mem,int seq,int threads)
+{
+	struct read_bench bench;
+	ktime_t start;
+	int cpu=0;
+	int n=0;
+	bench.mem=mem;
+	bench.seq=seq;
+	atomic_set(&bench.running,threads);
+	init_completion(&bench.done);
+	start=ktime_get();
+	for_each_online_cpu(cpu)
+	{
+		struct task_struct *task=NULL;
+		if(n++>=threads)
+			break;
+		task=kthread_create(read_bench_thread,&bench,"bigmem_bench/%d",cpu);
+		if(IS_ERR(task))
+		{
+			if(atomic_dec_and_test(&bench.running))
+				complete(&bench.done);
+			continue;
+		}
+		kthread_bind(task,cpu);
+		wake_up_process(task);
+	}
+	wait_for_completion(&bench.done);
+	return ktime_to_ns(ktime_sub(ktime_get(),start));
+}
+
+/// @brief 对比rwlock与seqcount读路径的正确性和多核扩展性
+static int test_read_scaling(struct big_mem *mem)
+{
+	char buf[64];
+	char buf_copy[64];
+	int threads=1;
+	int err=0;
+	if((err=read_bigmem(mem,100,buf,sizeof(buf)))<0||(err=read_bigmem_seq(mem,100,buf_copy,sizeof(buf)))<0)
+	{
+		printk("read failed\n");
+		return err;
+	}
+	if(memcmp(buf,buf_copy,sizeof(buf))!=0)
+	{
+		printk("read_bigmem_seq data not match\n");
+		return -1;
+	}
+	for(threads=1;;threads=threads*2>num_online_cpus()?num_online_cpus():threads*2)
+	{
+		s64 lock_ns=run_read_bench(mem,0,threads);
+		s64 seq_ns=run_read_bench(mem,1,threads);
+		printk("%d threads: rwlock %lld ns, seqcount %lld ns\n",threads,lock_ns,seq_ns);
+		if(threads==num_online_cpus())
+			break;
+	}
+	return 0;
+}
+
+/// @brief 输出测试过程中累计的统计
+static void print_stats(struct big_mem *mem)
+{
+	struct bigmem_stats stats;
+	if(get_bigmem_stats(mem,&stats)<0)
+		return;
+	printk("stats: read %llu ops %llu bytes, write %llu ops %llu bytes, cross block %llu, errors %llu\n",
+			stats.ops[BIGMEM_STAT_READ],stats.bytes[BIGMEM_STAT_READ],
+			stats.ops[BIGMEM_STAT_WRITE],stats.bytes[BIGMEM_STAT_WRITE],
+			stats.cross_block,stats.errors);
+}
+
 static int __init test_init(void)
 {
 	size_t size=5*1024*1024;
@@ -176,6 +402,11 @@ static int __init test_init(void)
 		printk("alloc_mem failed\n");
 		return -1;
 	}
+	if(test_bulk(&g_mem)<0)
+		printk("test_bulk error\n");
+	else
+		printk("test bulk ok\n");
+	printk("-----------------------\n");
 	if(write_mem(&g_mem)<0)
 		printk("write_mem error\n");
 	else
@@ -197,6 +428,17 @@ static int __init test_init(void)
 	else
 		printk("test cmp ok\n");
 	printk("-----------------------\n");
+	if(test_vmap(&g_mem)<0)
+		printk("test_vmap error\n");
+	else
+		printk("test vmap ok\n");
+	printk("-----------------------\n");
+	if(test_read_scaling(&g_mem)<0)
+		printk("test_read_scaling error\n");
+	else
+		printk("test read scaling ok\n");
+	printk("-----------------------\n");
+	print_stats(&g_mem);
 
 	if(create_proc_file(&g_mem)<0)
 	{
@@ -210,6 +452,10 @@ static int __init test_init(void)
 		}
 		return -1;
 	}
+	if(register_bigmem_dev(&g_mem,DEV_NAME)<0)
+		printk("register /dev/%s failed\n",DEV_NAME);
+	else
+		printk("register /dev/%s ok\n",DEV_NAME);
 	printk("catch the bigmem str: \n%s\n",read_buf);
 	printk("create proc file /proc/%s ok\n",PROC_NAME);
 	return 0;
@@ -223,6 +469,7 @@ static void __exit test_exit(void)
 		temp=0;
 	}
 	clean_proc_file();
+	unregister_bigmem_dev(&g_mem);
 	clean_bigmem(&g_mem);
 }
 
@@ -322,14 +569,881 @@ static int load_mem(struct big_mem *mem,const char *proc_name)
 	return 0;
 }
 
-int main()
+/// @brief 不加载内核模块,在进程内创建bigmem并测试读写
+static int test_local(void)
+{
+	struct big_mem mem;
+	struct bigmem_attr attr={.block_order=10};
+	char buf[512];
+	char buf_copy[512];
+	size_t start=4*1024*1024-100;
+	int res=0;
+	int err=0;
+	int i=0;
+	if((err=init_bigmem_attr(&mem,5*1024*1024,BIGMEM_HUGEPAGE,&attr))<0)
+	{
+		error_at_line(0,-err,__FILE__,__LINE__,"init_bigmem_attr failed");
+		return err;
+	}
+	for(i=0;i<sizeof(buf);++i)
+		buf[i]=(char)('a'+i%('z'-'a'));
+	/// 跨块读写
+	if((err=write_bigmem(&mem,start,buf,sizeof(buf)))<0||(err=read_bigmem(&mem,start,buf_copy,sizeof(buf)))<0)
+		goto clean;
+	if(memcmp(buf,buf_copy,sizeof(buf))!=0)
+	{
+		printf("read/write data not match\n");
+		err=-1;
+		goto clean;
+	}
+	/// 跨块设置与对比
+	memset(buf,'x',sizeof(buf));
+	if((err=set_bigmem(&mem,start,sizeof(buf),'x'))<0||(err=cmp_bigmem(&mem,start,buf,sizeof(buf),&res))<0)
+		goto clean;
+	if(res!=0)
+	{
+		printf("set/cmp data not match\n");
+		err=-1;
+		goto clean;
+	}
+	/// 跨块对比并定位第一个不同字节
+	{
+		size_t diff=0;
+		buf[sizeof(buf)-1]='y';
+		if((err=cmp_bigmem_diff(&mem,start,buf,sizeof(buf),&res,&diff))<0)
+			goto clean;
+		if(res<=0||diff!=start+sizeof(buf)-1)
+		{
+			printf("cmp_bigmem_diff failed\n");
+			err=-1;
+			goto clean;
+		}
+	}
+	/// 批量读写,各项分散在不同内存块中
+	{
+		struct bigmem_vec vec[3]={{10,buf,16},{start,buf+16,200},{start+1000,buf+216,8}};
+		struct bigmem_vec vec_copy[3]={{10,buf_copy,16},{start,buf_copy+16,200},{start+1000,buf_copy+216,8}};
+		memset(buf,'v',sizeof(buf));
+		if((err=writev_bigmem(&mem,vec,3))<0||(err=readv_bigmem(&mem,vec_copy,3))<0||(err=cmpv_bigmem(&mem,vec,3,&res))<0)
+			goto clean;
+		if(res!=0||memcmp(buf,buf_copy,224)!=0)
+		{
+			printf("writev/readv data not match\n");
+			err=-1;
+			goto clean;
+		}
+	}
+	/// 查找跨越内存块边界的字符串
+	{
+		const char *pattern="needle";
+		size_t pos=0;
+		if((err=write_bigmem(&mem,4*1024*1024-3,pattern,strlen(pattern)))<0)
+			goto clean;
+		if((err=find_bigmem(&mem,0,get_bigmem_len(&mem),pattern,strlen(pattern),&pos))<0||pos!=4*1024*1024-3)
+		{
+			printf("find_bigmem failed\n");
+			err=-1;
+			goto clean;
+		}
+	}
+	/// 重复内容中查找跨越内存块边界的长pattern,需要回退部分匹配
+	{
+		static char pattern[1025];
+		size_t pos=0;
+		memset(pattern,'a',1024);
+		pattern[1024]='b';
+		if((err=set_bigmem(&mem,4*1024*1024-8192,16384,'a'))<0||(err=set_bigmem(&mem,4*1024*1024+10,1,'b'))<0)
+			goto clean;
+		if((err=find_bigmem(&mem,4*1024*1024-8192,16384,pattern,sizeof(pattern),&pos))<0||pos!=4*1024*1024+10-1024)
+		{
+			printf("find_bigmem repetitive pattern failed\n");
+			err=-1;
+			goto clean;
+		}
+		pattern[1024]='c';
+		if((err=find_bigmem(&mem,4*1024*1024-8192,16384,pattern,sizeof(pattern),&pos))!=-ENOENT)
+		{
+			printf("find_bigmem found missing pattern\n");
+			err=-1;
+			goto clean;
+		}
+		err=0;
+	}
+	/// 跨块分段计算CRC32C,并检查内存块的CRC32C缓存在写入后失效
+	{
+		const char *check="123456789";
+		__u32 crc=0;
+		__u32 block_crc=0;
+		__u32 block_crc_copy=0;
+		if((err=write_bigmem(&mem,4*1024*1024-4,check,strlen(check)))<0||(err=enable_bigmem_crc(&mem))<0)
+			goto clean;
+		if((err=crc32c_bigmem(&mem,4*1024*1024-4,2,&crc))<0||(err=crc32c_bigmem(&mem,4*1024*1024-2,7,&crc))<0)
+			goto clean;
+		if((err=get_bigmem_block_crc(&mem,0,&block_crc))<0||(err=set_bigmem(&mem,4*1024*1024-1,1,'z'))<0||(err=get_bigmem_block_crc(&mem,0,&block_crc_copy))<0)
+			goto clean;
+		if(crc!=0xe3069283||block_crc==block_crc_copy)
+		{
+			printf("crc32c_bigmem failed\n");
+			err=-1;
+			goto clean;
+		}
+	}
+	/// 跨块写入标记两侧的页,获取后清零
+	{
+		unsigned long bitmap[32];
+		size_t count=0;
+		const unsigned long page=start>>12;
+		if((err=enable_bigmem_dirty(&mem,12))<0||(err=write_bigmem(&mem,start,buf,sizeof(buf)))<0)
+			goto clean;
+		if((err=fetch_bigmem_dirty(&mem,bitmap,sizeof(bitmap),&count))<0)
+			goto clean;
+		if(count!=2||!(bitmap[page/64]>>(page%64)&1)||!(bitmap[(page+1)/64]>>((page+1)%64)&1))
+		{
+			printf("dirty bitmap not match\n");
+			err=-1;
+			goto clean;
+		}
+		if((err=fetch_bigmem_dirty(&mem,bitmap,sizeof(bitmap),&count))<0||count!=0)
+		{
+			printf("dirty bitmap not cleared\n");
+			err=-1;
+		}
+	}
+clean:
+	clean_bigmem(&mem);
+	return err;
+}
+
+#define STREAM_MEM_SIZE (64*1024*1024)   ///< 流式写入测试的内存大小
+#define STREAM_HOT_SIZE (1024*1024)       ///< 模拟热数据的大小
+
+/// @brief 返回自start以来经过的纳秒数
+static long long elapsed_ns(const struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	return (end.tv_sec-start->tv_sec)*1000000000LL+(end.tv_nsec-start->tv_nsec);
+}
+
+/// @brief 按缓存行遍历热数据,返回耗时(ns)
+static long long touch_hot(const char *hot)
 {
+	struct timespec start;
+	volatile char sum=0;
+	size_t i=0;
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	for(i=0;i<STREAM_HOT_SIZE;i+=64)
+		sum+=hot[i];
+	return elapsed_ns(&start);
+}
+
+/// @brief 对比普通写入与流式写入的吞吐量,及其对热数据缓存的影响
+static int test_stream(void)
+{
+	struct big_mem mem;
+	struct bigmem_attr attr={.block_order=10};
+	char *hot=NULL;
+	char *buf=NULL;
+	size_t pos=0;
+	int stream=0;
+	int res=0;
 	int err=0;
-	if((err=load_mem(&g_mem,PROC_NAME))<0)
+	if((err=init_bigmem_attr(&mem,STREAM_MEM_SIZE,BIGMEM_POPULATE,&attr))<0)
+	{
+		error_at_line(0,-err,__FILE__,__LINE__,"init_bigmem_attr failed");
+		return err;
+	}
+	hot=(char*)malloc(STREAM_HOT_SIZE);
+	buf=(char*)malloc(STREAM_MEM_SIZE);
+	if(NULL==hot||NULL==buf)
+	{
+		err=-ENOMEM;
+		goto clean;
+	}
+	memset(hot,1,STREAM_HOT_SIZE);
+	memset(buf,'s',STREAM_MEM_SIZE);
+	for(stream=0;stream<2;stream++)
+	{
+		struct timespec start;
+		long long set_ns=0;
+		long long write_ns=0;
+		long long warm_ns=0;
+		long long set_hot_ns=0;
+		set_bigmem_stream_threshold(&mem,stream?STREAM_HOT_SIZE:0);
+		touch_hot(hot);
+		warm_ns=touch_hot(hot);
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		err=set_bigmem(&mem,0,STREAM_MEM_SIZE,(char)('a'+stream));
+		set_ns=elapsed_ns(&start);
+		set_hot_ns=touch_hot(hot);
+		if(err<0)
+			goto clean;
+		/// 全部数据都已设置,查找不到其他值
+		if(memchr_bigmem(&mem,0,STREAM_MEM_SIZE,(char)('b'-stream),&pos)!=-ENOENT)
+		{
+			printf("stream set data not match\n");
+			err=-1;
+			goto clean;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		err=write_bigmem(&mem,0,buf,STREAM_MEM_SIZE);
+		write_ns=elapsed_ns(&start);
+		if(err<0||(err=cmp_bigmem(&mem,0,buf,STREAM_MEM_SIZE,&res))<0)
+			goto clean;
+		if(res!=0)
+		{
+			printf("stream write data not match\n");
+			err=-1;
+			goto clean;
+		}
+		printf("%s: set %lld MB/s, write %lld MB/s, hot data walk %lld ns before set, %lld ns after\n",
+				stream?"stream":"cached",
+				set_ns>0?STREAM_MEM_SIZE*1000LL/set_ns:0,
+				write_ns>0?STREAM_MEM_SIZE*1000LL/write_ns:0,
+				warm_ns,set_hot_ns);
+	}
+clean:
+	free(hot);
+	free(buf);
+	clean_bigmem(&mem);
+	return err;
+}
+
+#define SNAP_PATH "/tmp/bigmem_test.snap"
+
+/// @brief 完整快照与增量快照的写入和恢复
+static int test_snapshot(void)
+{
+	struct big_mem mem;
+	struct big_mem mem_copy;
+	struct bigmem_attr attr={.block_order=1};
+	const size_t len=4*8192+100;   ///< 最后一个内存块不按页对齐
+	char buf[256];
+	int res=0;
+	int err=0;
+	int i=0;
+	if((err=init_bigmem_attr(&mem,len,0,&attr))<0)
+		return err;
+	if((err=init_bigmem_attr(&mem_copy,len,0,&attr))<0)
 	{
-		error_at_line(0,-err,__FILE__,__LINE__,"load mem error\n");
+		clean_bigmem(&mem);
+		return err;
+	}
+	for(i=0;i<sizeof(buf);i++)
+		buf[i]=(char)i;
+	if((err=enable_bigmem_crc(&mem))<0||(err=set_bigmem(&mem,0,len,'s'))<0||(err=write_bigmem(&mem,len-sizeof(buf),buf,sizeof(buf)))<0)
+		goto clean;
+	if((err=snapshot_bigmem(&mem,SNAP_PATH,0))<0||(err=restore_bigmem(&mem_copy,SNAP_PATH))<0)
+		goto clean;
+	/// 修改一个内存块后增量快照
+	if((err=write_bigmem(&mem,8192-10,buf,sizeof(buf)))<0)
+		goto clean;
+	if((err=snapshot_bigmem(&mem,SNAP_PATH,BIGMEM_SNAP_INCREMENTAL))<0||(err=restore_bigmem(&mem_copy,SNAP_PATH))<0)
+		goto clean;
+	for(i=0;i<len&&0==res;i+=sizeof(buf))
+	{
+		size_t n=len-i<sizeof(buf)?len-i:sizeof(buf);
+		if((err=read_bigmem(&mem,i,buf,n))<0||(err=cmp_bigmem(&mem_copy,i,buf,n,&res))<0)
+			goto clean;
+	}
+	if(res!=0)
+	{
+		printf("snapshot data not match\n");
+		err=-1;
+		goto clean;
+	}
+	/// 截断的快照不能恢复,增量快照时重写完整快照
+	{
+		struct stat st;
+		if(stat(SNAP_PATH,&st)<0||truncate(SNAP_PATH,st.st_size-50)<0)
+		{
+			err=-errno;
+			goto clean;
+		}
+	}
+	if(restore_bigmem(&mem_copy,SNAP_PATH)!=-EINVAL)
+	{
+		printf("restore truncated snapshot\n");
+		err=-1;
+		goto clean;
+	}
+	if((err=snapshot_bigmem(&mem,SNAP_PATH,BIGMEM_SNAP_INCREMENTAL))<0||(err=restore_bigmem(&mem_copy,SNAP_PATH))<0)
+		goto clean;
+clean:
+	unlink(SNAP_PATH);
+	clean_bigmem(&mem);
+	clean_bigmem(&mem_copy);
+	return err;
+}
+
+/// @brief 环形缓冲区记录跨越内存块及数据区末尾时的读写
+static int test_ring(void)
+{
+	struct big_mem mem;
+	struct bigmem_attr attr={.block_order=1};
+	struct bigmem_ring producer;
+	struct bigmem_ring consumer;
+	char buf[1000];
+	char buf_copy[1000];
+	int err=0;
+	int i=0;
+	/// 数据区8KB,跨越两个8KB内存块的边界
+	if((err=init_bigmem_attr(&mem,3*4096,0,&attr))<0)
+		return err;
+	if((err=init_bigmem_ring(&producer,&mem))<0||(err=attach_bigmem_ring(&consumer,&mem))<0)
+		goto clean;
+	if(get_bigmem_ring(&consumer,buf_copy,sizeof(buf_copy))!=-EAGAIN)
+	{
+		err=-1;
+		goto clean;
+	}
+	for(i=0;i<100;i++)
+	{
+		size_t len=sizeof(buf)-i;
+		memset(buf,'a'+i%26,len);
+		if((err=put_bigmem_ring(&producer,buf,len))<0)
+			break;
+		if((err=get_bigmem_ring(&consumer,buf_copy,sizeof(buf_copy)))!=len||memcmp(buf,buf_copy,len)!=0)
+		{
+			printf("ring record %d not match\n",i);
+			err=-1;
+			break;
+		}
+		err=0;
+	}
+	/// 预留的记录不跨越内存块,之前插入的填充由消费者跳过
+	for(i=0;i<100&&0==err;i++)
+	{
+		struct bigmem_ring_slot slot;
+		size_t len=sizeof(buf)-i;
+		memset(buf,'A'+i%26,len);
+		if((err=reserve_bigmem_ring(&producer,len,&slot))<0)
+			break;
+		memcpy(slot.data,buf,len);
+		commit_bigmem_ring(&producer,&slot);
+		if((err=get_bigmem_ring(&consumer,buf_copy,sizeof(buf_copy)))!=len||memcmp(buf,buf_copy,len)!=0)
+		{
+			printf("ring slot %d not match\n",i);
+			err=-1;
+			break;
+		}
+		err=0;
+	}
+	/// 数据区中连续的空间只有4KB
+	if(0==err)
+	{
+		struct bigmem_ring_slot slot;
+		if(reserve_bigmem_ring(&producer,5000,&slot)!=-EMSGSIZE)
+		{
+			printf("reserve larger than block\n");
+			err=-1;
+		}
+	}
+	/// 写满后返回-ENOSPC
+	while(err==0)
+		err=put_bigmem_ring(&producer,buf,sizeof(buf));
+	if(err==-ENOSPC)
+		err=0;
+clean:
+	clean_bigmem(&mem);
+	return err;
+}
+
+/// @brief 用户态统计,每次调用只计一次
+static int test_stats(void)
+{
+	struct big_mem mem;
+	struct bigmem_attr attr={.block_order=1};
+	struct bigmem_stats stats;
+	char buf[100];
+	int res=0;
+	int err=0;
+	if((err=init_bigmem_attr(&mem,4*8192,0,&attr))<0)
+		return err;
+	if((err=enable_bigmem_stats(&mem,NULL))<0)
+	{
+		/// 编译时未定义BIGMEM_STATS
+		if(-EOPNOTSUPP==err)
+			err=0;
+		goto clean;
+	}
+	memset(buf,'t',sizeof(buf));
+	if((err=write_bigmem(&mem,8192-50,buf,sizeof(buf)))<0||(err=read_bigmem(&mem,0,buf,10))<0||
+		(err=set_bigmem(&mem,0,4*8192,'t'))<0||(err=cmp_bigmem(&mem,100,buf,sizeof(buf),&res))<0)
+		goto clean;
+	if(write_bigmem(&mem,4*8192-1,buf,2)!=-EFAULT)
+	{
+		err=-1;
+		goto clean;
+	}
+	if((err=get_bigmem_stats(&mem,&stats))<0)
+		goto clean;
+	if(stats.ops[BIGMEM_STAT_WRITE]!=1||stats.bytes[BIGMEM_STAT_WRITE]!=sizeof(buf)||stats.ops[BIGMEM_STAT_READ]!=1||
+		stats.ops[BIGMEM_STAT_SET]!=1||stats.bytes[BIGMEM_STAT_SET]!=4*8192||stats.ops[BIGMEM_STAT_CMP]!=1||
+		stats.cross_block!=2||stats.errors!=1)
+	{
+		printf("stats not match\n");
+		err=-1;
+	}
+clean:
+	clean_bigmem(&mem);
+	return err;
+}
+
+/// @brief 释放load_bigmem_desc建立的块数组,不取消映射
+static void free_desc_mem(struct big_mem *mem)
+{
+	free(mem->addrs);
+	free(mem->sizes);
+	free(mem->offsets);
+	free(mem->nodes);
+}
+
+/// @brief 二进制描述符的解析,包括版本1的内存块描述和截断的输入
+static int test_desc(void)
+{
+	const size_t sizes[]={8192,8192,4096};
+	const unsigned long count=sizeof(sizes)/sizeof(sizes[0]);
+	char data[sizeof(struct bigmem_desc_head)+sizeof(sizes)/sizeof(sizes[0])*sizeof(struct bigmem_desc_block)];
+	struct bigmem_desc_head *head=(struct bigmem_desc_head*)data;
+	struct bigmem_desc_block *blocks=(struct bigmem_desc_block*)(head+1);
+	struct big_mem mem;
+	size_t len=0;
+	int err=0;
+	unsigned long i=0;
+	memset(data,0,sizeof(data));
+	head->magic=BIGMEM_DESC_MAGIC;
+	head->version=BIGMEM_DESC_VERSION;
+	head->head_size=sizeof(struct bigmem_desc_head);
+	head->block_size=sizeof(struct bigmem_desc_block);
+	head->mem_count=count;
+	for(i=0;i<count;i++)
+	{
+		blocks[i].addr=0x100000*(i+1);
+		blocks[i].size=sizes[i];
+		blocks[i].node=i;
+		head->mem_size+=sizes[i];
+	}
+	if((err=load_bigmem_desc(&mem,data,sizeof(data)))<0)
+		return err;
+	if(mem.mem_count!=count||get_bigmem_len(&mem)!=head->mem_size||mem.addrs[1]!=0x200000||get_bigmem_node(&mem,8192)!=1)
+	{
+		printf("desc not match\n");
+		err=-1;
+	}
+	free_desc_mem(&mem);
+	if(err<0)
+		return err;
+	/// 任何截断的输入都不能越界读取
+	for(len=0;len<sizeof(data);len++)
+		if(load_bigmem_desc(&mem,data,len)!=-EINVAL)
+		{
+			printf("desc truncated to %zu accepted\n",len);
+			return -1;
+		}
+	/// 内存块大小与mem_size不一致
+	head->mem_size++;
+	if(load_bigmem_desc(&mem,data,sizeof(data))!=-EINVAL)
+	{
+		printf("desc with wrong mem_size accepted\n");
 		return -1;
 	}
+	head->mem_size--;
+	/// 空内存块,包括首块为空
+	for(i=0;i<2;i++)
+	{
+		size_t size=blocks[i].size;
+		blocks[i].size=0;
+		blocks[2].size+=size;
+		if(load_bigmem_desc(&mem,data,sizeof(data))!=-EINVAL)
+		{
+			printf("desc with empty block %lu accepted\n",i);
+			return -1;
+		}
+		blocks[2].size-=size;
+		blocks[i].size=size;
+	}
+	/// 版本1的内存块描述不含节点
+	head->version=1;
+	head->block_size=BIGMEM_DESC_BLOCK_V1_SIZE;
+	for(i=0;i<count;i++)
+		memcpy((char*)blocks+i*BIGMEM_DESC_BLOCK_V1_SIZE,&blocks[i],BIGMEM_DESC_BLOCK_V1_SIZE);
+	len=sizeof(struct bigmem_desc_head)+count*BIGMEM_DESC_BLOCK_V1_SIZE;
+	if((err=load_bigmem_desc(&mem,data,len))<0)
+		return err;
+	if(mem.mem_count!=count||mem.sizes[2]!=4096||get_bigmem_node(&mem,8192)!=-1)
+	{
+		printf("desc v1 not match\n");
+		err=-1;
+	}
+	free_desc_mem(&mem);
+	return err;
+}
+
+#define RING_PRODUCERS 2
+#define RING_RECORDS 10000
+
+/// @brief 多生产者测试中的一个生产者,使用各自关联的句柄
+struct ring_producer
+{
+	struct big_mem *mem;
+	const int *stop;   ///< 消费者出错时置位
+	int id;
+	int err;
+};
+
+/// @brief 交替使用put和reserve写入记录,内容为生产者编号和序号
+static void *ring_produce(void *arg)
+{
+	struct ring_producer *producer=(struct ring_producer*)arg;
+	struct bigmem_ring ring;
+	int record[2]={producer->id,0};
+	if((producer->err=attach_bigmem_ring(&ring,producer->mem))<0)
+		return NULL;
+	while(record[1]<RING_RECORDS&&!__atomic_load_n(producer->stop,__ATOMIC_RELAXED))
+	{
+		struct bigmem_ring_slot slot;
+		int err=0;
+		if(record[1]%2)
+			err=put_bigmem_ring(&ring,record,sizeof(record));
+		else if(0==(err=reserve_bigmem_ring(&ring,sizeof(record),&slot)))
+		{
+			memcpy(slot.data,record,sizeof(record));
+			commit_bigmem_ring(&ring,&slot);
+		}
+		if(err==-ENOSPC)
+		{
+			sched_yield();
+			continue;
+		}
+		if(err<0)
+		{
+			producer->err=err;
+			return NULL;
+		}
+		record[1]++;
+	}
+	return NULL;
+}
+
+/// @brief 多个生产者并发写入,每个生产者的记录按序到达
+static int test_ring_producers(void)
+{
+	struct big_mem mem;
+	struct bigmem_attr attr={.block_order=1};
+	struct bigmem_ring consumer;
+	struct ring_producer producers[RING_PRODUCERS];
+	pthread_t threads[RING_PRODUCERS];
+	int next[RING_PRODUCERS]={0};
+	int left=RING_PRODUCERS*RING_RECORDS;
+	int stop=0;
+	int err=0;
+	int i=0;
+	if((err=init_bigmem_attr(&mem,3*4096,0,&attr))<0)
+		return err;
+	if((err=init_bigmem_ring(&consumer,&mem))<0)
+		goto clean;
+	for(i=0;i<RING_PRODUCERS;i++)
+	{
+		producers[i].mem=&mem;
+		producers[i].stop=&stop;
+		producers[i].id=i;
+		producers[i].err=0;
+		pthread_create(&threads[i],NULL,ring_produce,&producers[i]);
+	}
+	while(left>0&&0==err)
+	{
+		int record[2];
+		int ret=get_bigmem_ring(&consumer,record,sizeof(record));
+		if(ret==-EAGAIN)
+		{
+			sched_yield();
+			continue;
+		}
+		if(ret!=sizeof(record)||record[0]<0||record[0]>=RING_PRODUCERS||record[1]!=next[record[0]])
+		{
+			printf("ring producers record %d not match\n",RING_PRODUCERS*RING_RECORDS-left);
+			err=-1;
+			break;
+		}
+		next[record[0]]++;
+		left--;
+	}
+	/// 出错时生产者可能因空间不足一直重试
+	__atomic_store_n(&stop,1,__ATOMIC_RELAXED);
+	for(i=0;i<RING_PRODUCERS;i++)
+	{
+		pthread_join(threads[i],NULL);
+		if(0==err)
+			err=producers[i].err;
+	}
+clean:
+	clean_bigmem(&mem);
+	return err;
+}
+
+/// @brief 通过read和splice读取字符设备,与映射的内容对比并输出splice的吞吐量
+static int test_dev_read(struct big_mem *mem,const char *path)
+{
+	char buf[4096];
+	struct timespec start;
+	long long splice_ns=0;
+	size_t len=get_bigmem_len(mem);
+	size_t left=len;
+	int pipefd[2]={-1,-1};
+	int null_fd=-1;
+	int fd=-1;
+	int res=0;
+	int err=0;
+	if((fd=open(path,O_RDONLY))<0)
+		return -errno;
+	/// 跨越内存块边界的pread
+	if(len>4*1024*1024+sizeof(buf))
+	{
+		if(pread(fd,buf,sizeof(buf),4*1024*1024-100)!=sizeof(buf))
+		{
+			err=-errno;
+			goto clean;
+		}
+		if((err=cmp_bigmem(mem,4*1024*1024-100,buf,sizeof(buf),&res))<0||res!=0)
+		{
+			printf("read data not match\n");
+			err=-1;
+			goto clean;
+		}
+	}
+	/// 经管道将全部内容splice到/dev/null
+	if(pipe(pipefd)<0||(null_fd=open("/dev/null",O_WRONLY))<0)
+	{
+		err=-errno;
+		goto clean;
+	}
+	lseek(fd,0,SEEK_SET);
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	while(left>0)
+	{
+		ssize_t n=splice(fd,NULL,pipefd[1],NULL,left,0);
+		if(n<=0)
+		{
+			err=n<0?-errno:-EIO;
+			goto clean;
+		}
+		left-=n;
+		while(n>0)
+		{
+			ssize_t m=splice(pipefd[0],NULL,null_fd,NULL,n,0);
+			if(m<=0)
+			{
+				err=m<0?-errno:-EIO;
+				goto clean;
+			}
+			n-=m;
+		}
+	}
+	splice_ns=elapsed_ns(&start);
+	printf("splice %zu bytes, %lld MB/s\n",len,splice_ns>0?(long long)len*1000/splice_ns:0);
+clean:
+	if(pipefd[0]>=0)
+	{
+		close(pipefd[0]);
+		close(pipefd[1]);
+	}
+	if(null_fd>=0)
+		close(null_fd);
+	close(fd);
+	return err;
+}
+
+/// @brief 经/proc文件让内核写入并发布一条记录
+static int publish_record(const char *data)
+{
+	int fd=open("/proc/" PROC_NAME,O_WRONLY);
+	int err=0;
+	if(fd<0)
+		return -errno;
+	if(write(fd,data,strlen(data))<0)
+		err=-errno;
+	close(fd);
+	return err;
+}
+
+/// @brief 通过DESC ioctl获取内核生成的描述符并解析,与设备信息对比
+static int test_dev_desc(struct big_mem *dev_mem,const char *path)
+{
+	struct bigmem_desc_req req;
+	struct bigmem_desc_head head;
+	struct big_mem mem;
+	void *data=NULL;
+	size_t len=0;
+	int fd=open(path,O_RDONLY);
+	int err=0;
+	if(fd<0)
+		return -errno;
+	/// 缓冲区不足时返回ENOSPC和所需大小
+	req.buf=(__u64)(unsigned long)&head;
+	req.len=sizeof(head);
+	if(ioctl(fd,BIGMEM_IOC_DESC,&req)==0||errno!=ENOSPC||req.len<=sizeof(head))
+	{
+		printf("desc ioctl with short buffer\n");
+		err=-1;
+		goto close_fd;
+	}
+	if((err=read_bigmem_desc(fd,&data,&len))<0)
+		goto close_fd;
+	if(len!=req.len)
+	{
+		printf("desc length %zu not %llu\n",len,(unsigned long long)req.len);
+		err=-1;
+		goto free_data;
+	}
+	if((err=load_bigmem_desc(&mem,data,len))<0)
+		goto free_data;
+	if(get_bigmem_len(&mem)!=get_bigmem_len(dev_mem))
+	{
+		printf("desc mem_size not match\n");
+		err=-1;
+	}
+	free_desc_mem(&mem);
+	/// 截断的描述符被拒绝
+	if(0==err&&load_bigmem_desc(&mem,data,len-1)!=-EINVAL)
+	{
+		printf("truncated desc accepted\n");
+		err=-1;
+	}
+free_data:
+	free(data);
+close_fd:
+	close(fd);
+	return err;
+}
+
+/// @brief 测试水位,确认和poll唤醒
+static int test_dev_event(const char *path)
+{
+	const char *record="event";
+	struct bigmem_event event;
+	struct pollfd pfd;
+	pid_t pid=0;
+	int status=0;
+	int err=0;
+	/// 两条记录才唤醒
+	if((pfd.fd=open_bigmem_event(path,0,2))<0)
+		return pfd.fd;
+	pfd.events=POLLIN;
+	if((err=publish_record(record))<0)
+		goto clean;
+	if(poll(&pfd,1,0)!=0)
+	{
+		printf("poll ready below watermark\n");
+		err=-1;
+		goto clean;
+	}
+	/// 子进程稍后发布第二条记录,poll应被唤醒
+	if((pid=fork())==0)
+	{
+		usleep(100*1000);
+		_exit(publish_record(record)<0);
+	}
+	if(poll(&pfd,1,5000)!=1||!(pfd.revents&POLLIN))
+	{
+		printf("poll not woken at watermark\n");
+		err=-1;
+	}
+	waitpid(pid,&status,0);
+	if(err<0)
+		goto clean;
+	if((err=ack_bigmem_event(pfd.fd,&event))<0)
+		goto clean;
+	if(event.records!=2||event.bytes!=2*strlen(record))
+	{
+		printf("ack returned %llu records %llu bytes\n",(unsigned long long)event.records,(unsigned long long)event.bytes);
+		err=-1;
+		goto clean;
+	}
+	/// 确认后重新计数
+	if(poll(&pfd,1,0)!=0)
+	{
+		printf("poll ready after ack\n");
+		err=-1;
+	}
+clean:
+	close(pfd.fd);
+	return err;
+}
+
+int main(int argc,char *argv[])
+{
+	int err=0;
+	/// local: 不依赖内核模块的测试
+	if(argc>1&&strcmp(argv[1],"local")==0)
+	{
+		if(test_local()<0)
+		{
+			printf("test local error\n");
+			return -1;
+		}
+		printf("test local ok\n");
+		if(test_ring()<0)
+		{
+			printf("test ring error\n");
+			return -1;
+		}
+		printf("test ring ok\n");
+		if(test_desc()<0)
+		{
+			printf("test desc error\n");
+			return -1;
+		}
+		printf("test desc ok\n");
+		if(test_stats()<0)
+		{
+			printf("test stats error\n");
+			return -1;
+		}
+		printf("test stats ok\n");
+		if(test_ring_producers()<0)
+		{
+			printf("test ring producers error\n");
+			return -1;
+		}
+		printf("test ring producers ok\n");
+		if(test_stream()<0)
+		{
+			printf("test stream error\n");
+			return -1;
+		}
+		printf("test stream ok\n");
+		if(test_snapshot()<0)
+		{
+			printf("test snapshot error\n");
+			return -1;
+		}
+		printf("test snapshot ok\n");
+		return 0;
+	}
+	/// 优先通过字符设备映射,失败时回退到/proc+/dev/mem
+	if((err=open_bigmem(&g_mem,"/dev/" DEV_NAME,PROT_READ|PROT_WRITE,MAP_SHARED))<0)
+	{
+		error_at_line(0,-err,__FILE__,__LINE__,"open_bigmem failed, try /dev/mem");
+		if((err=load_mem(&g_mem,PROC_NAME))<0)
+		{
+			error_at_line(0,-err,__FILE__,__LINE__,"load mem error\n");
+			return -1;
+		}
+	}
+	else
+	{
+		if((err=test_dev_read(&g_mem,"/dev/" DEV_NAME))<0)
+			error_at_line(0,-err,__FILE__,__LINE__,"test_dev_read failed");
+		if((err=test_dev_desc(&g_mem,"/dev/" DEV_NAME))<0)
+			error_at_line(0,-err,__FILE__,__LINE__,"test_dev_desc failed");
+		else
+			printf("test dev desc ok\n");
+		if((err=test_dev_event("/dev/" DEV_NAME))<0)
+			error_at_line(0,-err,__FILE__,__LINE__,"test_dev_event failed");
+		else
+			printf("test dev event ok\n");
+	}
 	printf("display the mem:\n");
 	display_bigmem(&g_mem,stdout);
 	unmmap_clean_bigmem(&g_mem);